@@ -16,7 +16,7 @@
  * Get the next room based on current room and direction
  * Returns the ID of the next room, or 0 if no exit in that direction
  */
-int get_next_room(int current_room, char direction) {
+int get_next_room_building1(int current_room, char direction) {
     switch(current_room) {
         case 1:  // Room 1
             switch(direction) {
@@ -116,7 +116,7 @@ int get_next_room(int current_room, char direction) {
 /**
  * Initialize the room data based on the provided diagram
  */
-void initialize_rooms(Room rooms[]) {
+void initialize_rooms_building1(Room rooms[]) {
     // Room 1
     rooms[0].id = 1;
     strcpy(rooms[0].north_desc, "You run north, and eventually find an old, angry man imprisoned for 1000 years. He begs you to free him, but you refuse.");
@@ -234,57 +234,3 @@ const char* get_room_description_building1(Room rooms[], int current_room, char
         default: return "Invalid direction!";
     }
 }
-
-/**
- * Randomize the building order
- */
-void randomize_building_order(Room rooms[], int building_order[]) {
-	// Initialize the building order array if needed
-	for (int i = 0; i < MAX_ROOMS; i++) {
-		building_order[i] = i;
-	}
-	
-	// Fisher-Yates shuffle algorithm
-	for (int i = MAX_ROOMS - 1; i > 0; i--) {
-		int j = rand() % (i + 1);
-		int temp = building_order[i];
-		building_order[i] = building_order[j];
-		building_order[j] = temp;
-	}
-	
-	// Log the new building order
-	char order_str[100] = "";
-	for (int i = 0; i < MAX_ROOMS; i++) {
-		char temp[10];
-		sprintf(temp, "%d ", building_order[i] + 1);
-		strcat(order_str, temp);
-	}
-	syslog(LOG_INFO, "New building order: %s", order_str);
-}
-
-/**
- * Check if a room is a connector room
- */
-bool is_connector_room(Room rooms[], int room_id) {
-	if (room_id < 1 || room_id > MAX_ROOMS) {
-		return false;
-	}
-	
-	return rooms[room_id - 1].is_connector_room;
-}
-
-/**
- * Get the building ID that this room connects to
- * Returns 0 if the room doesn't connect to another building
- */
-int get_connected_building(Room rooms[], int room_id) {
-	if (room_id < 1 || room_id > MAX_ROOMS) {
-		return 0;
-	}
-	
-	if (!rooms[room_id - 1].is_connector_room) {
-		return 0;
-	}
-	
-	return rooms[room_id - 1].connected_building_id;
-}
@@ -19,7 +19,7 @@
  * 
  * Note: This function will be called for this specific building only
  */
-int get_next_room(int current_room, char direction) {
+int get_next_room_building2(int current_room, char direction) {
     switch(current_room) {
         case 1:  // Room 1
             switch(direction) {
@@ -254,30 +254,3 @@ const char* get_room_description_building2(Room rooms[], int current_room, char
         default: return "Invalid direction!";
     }
 }
-
-/**
- * Check if a room is a connector room
- */
-bool is_connector_room(Room rooms[], int room_id) {
-    if (room_id < 1 || room_id > MAX_ROOMS) {
-        return false;
-    }
-    
-    return rooms[room_id - 1].is_connector_room;
-}
-
-/**
- * Get the building ID that this room connects to
- * Returns 0 if the room doesn't connect to another building
- */
-int get_connected_building(Room rooms[], int room_id) {
-    if (room_id < 1 || room_id > MAX_ROOMS) {
-        return 0;
-    }
-    
-    if (!rooms[room_id - 1].is_connector_room) {
-        return 0;
-    }
-    
-    return rooms[room_id - 1].connected_building_id;
-}
@@ -6,7 +6,7 @@
 #include "rooms.h"
 
 // navigate to next room depending on direction
-int get_next_room(int current_room, char direction)
+int get_next_room_building3(int current_room, char direction)
 {
     switch (current_room)
     {
@@ -166,7 +166,7 @@ int get_next_room(int current_room, char direction)
 }
 
 // set up room data
-void initialize_rooms(Room rooms[])
+void initialize_rooms_building3(Room rooms[])
 {
 
     // room 1
@@ -297,31 +297,3 @@ const char *get_room_description_building3(Room rooms[], int current_room, char
         return "Invalid direction!";
     }
 }
-
-// randomize orders to building
-void randomize_building_order(Room rooms[], int building_order[])
-{
-    // initialize the building order array
-    for (int i = 0; i < MAX_ROOMS; i++)
-    {
-        building_order[i] = i;
-    }
-
-    for (int i = MAX_ROOMS - 1; i > 0; i--)
-    {
-        int j = rand() % (i + 1);
-        int temp = building_order[i];
-        building_order[i] = building_order[j];
-        building_order[j] = temp;
-    }
-
-    // make new building order
-    char order_str[100] = "";
-    for (int i = 0; i < MAX_ROOMS; i++)
-    {
-        char temp[10];
-        sprintf(temp, "%d ", building_order[i] + 1);
-        strcat(order_str, temp);
-    }
-    syslog(LOG_INFO, "New building order: %s", order_str);
-}
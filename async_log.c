@@ -0,0 +1,208 @@
+/**
+ * async_log.c - Non-blocking logging for the packet path
+ *
+ * The ring is a bounded multi-producer queue in which every slot carries a
+ * sequence number (Vyukov's design): a producer claims a slot with one
+ * compare-and-swap on the enqueue position and publishes it by bumping the
+ * slot's sequence, so worker threads never block each other or the drain
+ * thread. When the ring is full the message is dropped and counted.
+ *
+ * The drain thread sleeps in a blocking read of an eventfd. A producer
+ * signals it once per wakeup, the way publisher.c wakes the control loop,
+ * so an idle server's drain thread uses no CPU.
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "async_log.h"
+
+#define LOG_RING_SIZE 4096        // Must be a power of two
+#define LOG_MESSAGE_SIZE 240
+
+typedef struct {
+    atomic_size_t sequence;
+    int level;
+    char message[LOG_MESSAGE_SIZE];
+} LogSlot;
+
+int async_log_max_level = LOG_INFO;
+unsigned async_log_sample_every[ASYNC_LOG_LEVELS];
+__thread unsigned async_log_sample_count[ASYNC_LOG_LEVELS];
+
+static LogSlot ring[LOG_RING_SIZE];
+static _Alignas(64) atomic_size_t enqueue_pos;
+static _Alignas(64) size_t dequeue_pos;   // Only the drain thread touches this
+static atomic_ulong dropped;
+static atomic_bool draining;
+static int wake_fd = -1;          // Blocking eventfd the drain thread waits on
+static atomic_bool wake_pending;  // wake_fd has been signalled and not yet consumed
+static bool started = false;
+static pthread_t drain_thread;
+
+/**
+ * Take the next message off the ring
+ * Returns true and fills level/message if one was waiting
+ */
+static bool ring_pop(int *level, char *message) {
+    LogSlot *slot = &ring[dequeue_pos & (LOG_RING_SIZE - 1)];
+    size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+
+    if (seq != dequeue_pos + 1) {
+        return false;
+    }
+
+    *level = slot->level;
+    memcpy(message, slot->message, LOG_MESSAGE_SIZE);
+    atomic_store_explicit(&slot->sequence, dequeue_pos + LOG_RING_SIZE, memory_order_release);
+    dequeue_pos++;
+    return true;
+}
+
+/**
+ * Drain thread: wait for a signal, then copy waiting messages into syslog
+ */
+static void *drain_main(void *arg) {
+    char message[LOG_MESSAGE_SIZE];
+    unsigned long reported_drops = 0;
+    int level;
+
+    for (;;) {
+        // Consume the wakeup before draining, so a write racing with the drain signals again
+        uint64_t count;
+        if (read(wake_fd, &count, sizeof(count)) == sizeof(count)) {
+            atomic_store(&wake_pending, false);
+        }
+        bool stopping = !atomic_load_explicit(&draining, memory_order_acquire);
+
+        while (ring_pop(&level, message)) {
+            syslog(level, "%s", message);
+        }
+
+        unsigned long drops = atomic_load_explicit(&dropped, memory_order_relaxed);
+        if (drops != reported_drops) {
+            syslog(LOG_WARNING, "Log ring full, %lu messages dropped", drops - reported_drops);
+            reported_drops = drops;
+        }
+
+        if (stopping) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Start the drain thread; until then messages go straight to syslog
+ * Returns 0 on success, -1 if the thread could not be created
+ */
+int async_log_start(void) {
+    for (size_t i = 0; i < LOG_RING_SIZE; i++) {
+        atomic_init(&ring[i].sequence, i);
+    }
+    atomic_init(&enqueue_pos, 0);
+    dequeue_pos = 0;
+    atomic_store(&draining, true);
+    atomic_store(&wake_pending, false);
+
+    wake_fd = eventfd(0, EFD_CLOEXEC);
+    if (wake_fd < 0) {
+        return -1;
+    }
+    if (pthread_create(&drain_thread, NULL, drain_main, NULL) != 0) {
+        close(wake_fd);
+        wake_fd = -1;
+        return -1;
+    }
+    started = true;
+    return 0;
+}
+
+/**
+ * Flush everything still in the ring and stop the drain thread
+ */
+void async_log_stop(void) {
+    if (!started) {
+        return;
+    }
+    atomic_store_explicit(&draining, false, memory_order_release);
+    uint64_t one = 1;
+    if (write(wake_fd, &one, sizeof(one)) < 0) {
+        syslog(LOG_ERR, "Could not wake the log drain thread");
+    }
+    pthread_join(drain_thread, NULL);
+    close(wake_fd);
+    wake_fd = -1;
+    started = false;
+}
+
+/**
+ * Log only one in every `every` messages at this level (0 or 1 logs all)
+ */
+void async_log_set_sampling(int level, unsigned every) {
+    if (level >= 0 && level < ASYNC_LOG_LEVELS) {
+        async_log_sample_every[level] = every;
+    }
+}
+
+/**
+ * Format a message into the ring without blocking
+ */
+void async_log_write(int level, const char *fmt, ...) {
+    va_list args;
+
+    if (!started) {
+        va_start(args, fmt);
+        vsyslog(level, fmt, args);
+        va_end(args);
+        return;
+    }
+
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    LogSlot *slot;
+
+    for (;;) {
+        slot = &ring[pos & (LOG_RING_SIZE - 1)];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            // The drain thread hasn't freed this slot yet: ring is full
+            atomic_fetch_add_explicit(&dropped, 1, memory_order_relaxed);
+            return;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->level = level;
+    va_start(args, fmt);
+    vsnprintf(slot->message, LOG_MESSAGE_SIZE, fmt, args);
+    va_end(args);
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+    // Wake the drain thread unless a signal is already waiting for it
+    if (!atomic_exchange(&wake_pending, true)) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            atomic_store(&wake_pending, false);
+        }
+    }
+}
+
+/**
+ * Number of messages dropped because the ring was full
+ */
+unsigned long async_log_dropped(void) {
+    return atomic_load_explicit(&dropped, memory_order_relaxed);
+}
@@ -0,0 +1,54 @@
+/**
+ * async_log.h - Non-blocking logging for the packet path
+ *
+ * ASYNC_LOG() formats a message into a lock-free ring buffer and returns;
+ * a background thread drains the ring into syslog. Messages above the
+ * configured level, or skipped by per-level sampling, cost one inline
+ * check and never evaluate their arguments.
+ */
+#ifndef ASYNC_LOG_H
+#define ASYNC_LOG_H
+#include <stdbool.h>
+#include <syslog.h>
+
+#define ASYNC_LOG_LEVELS (LOG_DEBUG + 1)
+
+// Configuration read by the inline check; set before workers start
+extern int async_log_max_level;
+extern unsigned async_log_sample_every[ASYNC_LOG_LEVELS];
+extern __thread unsigned async_log_sample_count[ASYNC_LOG_LEVELS];
+
+/**
+ * Decide whether a message at this level should be logged
+ * Sampling keeps one message in every async_log_sample_every[level]
+ */
+static inline bool async_log_enabled(int level) {
+    if (level > async_log_max_level) {
+        return false;
+    }
+    unsigned every = async_log_sample_every[level];
+    if (every <= 1) {
+        return true;
+    }
+    if (++async_log_sample_count[level] < every) {
+        return false;
+    }
+    async_log_sample_count[level] = 0;
+    return true;
+}
+
+#define ASYNC_LOG(level, ...) \
+    do { \
+        if (async_log_enabled(level)) { \
+            async_log_write(level, __VA_ARGS__); \
+        } \
+    } while (0)
+
+// Function prototypes
+int async_log_start(void);
+void async_log_stop(void);
+void async_log_set_sampling(int level, unsigned every);
+void async_log_write(int level, const char *fmt, ...) __attribute__((format(printf, 2, 3)));
+unsigned long async_log_dropped(void);
+
+#endif /* ASYNC_LOG_H */
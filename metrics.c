@@ -0,0 +1,224 @@
+/**
+ * metrics.c - Counter registry and Prometheus text export
+ *
+ * Metrics blocks are registered at startup. A snapshot sums them all and
+ * writes the Prometheus text exposition format; the stats endpoint is a
+ * UDP socket on localhost, watched by the control loop, that answers any
+ * datagram with a snapshot, e.g.
+ *     echo | nc -u -w1 127.0.0.1 8889
+ */
+
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include "metrics.h"
+#include "async_log.h"
+
+#define METRICS_REPLY_SIZE 60000   // Fits in one UDP datagram
+#define METRICS_MIN_EXP 10         // Smallest exported histogram bound: 2^10 ns, about 1 us
+#define METRICS_MAX_EXP 32         // Largest: 2^32 ns, about 4.3 s
+
+static Metrics *blocks[METRICS_MAX_BLOCKS];
+static int num_blocks;
+static pthread_mutex_t registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static int server_fd = -1;
+static metrics_extra_fn server_extra;
+
+static const char *const stage_names[NUM_STAGES] = {
+    [STAGE_RECEIVE] = "receive",
+    [STAGE_LOOKUP] = "lookup",
+    [STAGE_MOVEMENT] = "movement",
+    [STAGE_FORMAT] = "format",
+    [STAGE_PUBLISH] = "publish",
+    [STAGE_TICK] = "tick",
+};
+
+static const struct {
+    const char *name;
+    const char *help;
+} counter_info[NUM_COUNTERS] = {
+    [COUNTER_DATAGRAMS] = { "mud_datagrams_total", "UDP datagrams received" },
+    [COUNTER_TEXT_COMMANDS] = { "mud_text_commands_total", "Text commands received" },
+    [COUNTER_BINARY_FRAMES] = { "mud_binary_frames_total", "Binary protocol frames received" },
+    [COUNTER_JOINS] = { "mud_sessions_joined_total", "Player sessions started" },
+    [COUNTER_REJECTED_JOINS] = { "mud_joins_rejected_total", "New players turned away because the server was full" },
+    [COUNTER_MOVES] = { "mud_moves_total", "Successful moves between rooms" },
+    [COUNTER_BLOCKED_MOVES] = { "mud_moves_blocked_total", "Moves toward a direction with no exit" },
+    [COUNTER_RESETS] = { "mud_resets_total", "Game resets" },
+    [COUNTER_INVALID_COMMANDS] = { "mud_invalid_commands_total", "Commands that could not be parsed" },
+    [COUNTER_EVICTIONS] = { "mud_sessions_evicted_total", "Player sessions evicted for idling" },
+    [COUNTER_RATE_LIMITED] = { "mud_commands_rate_limited_total", "Commands dropped because a player exceeded the command rate" },
+    [COUNTER_COALESCED_MESSAGES] = { "mud_messages_coalesced_total", "Messages dropped within a batch for a newer one, or for a room description, to the same player" },
+    [COUNTER_DROPPED_INTENTS] = { "mud_intents_dropped_total", "Moves and resets dropped because the tick queue was full" },
+};
+
+/**
+ * Add a block to the snapshot
+ * Returns 0 on success, -1 if the registry is full
+ */
+int metrics_register(Metrics *m) {
+    pthread_mutex_lock(&registry_lock);
+    if (num_blocks == METRICS_MAX_BLOCKS) {
+        pthread_mutex_unlock(&registry_lock);
+        return -1;
+    }
+    blocks[num_blocks++] = m;
+    pthread_mutex_unlock(&registry_lock);
+    return 0;
+}
+
+/**
+ * printf into buf at *len, never past cap
+ */
+static void append(char *buf, size_t cap, size_t *len, const char *fmt, ...) {
+    if (*len >= cap) {
+        return;
+    }
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf + *len, cap - *len, fmt, args);
+    va_end(args);
+    if (n > 0) {
+        *len += (size_t)n < cap - *len ? (size_t)n : cap - *len - 1;
+    }
+}
+
+/**
+ * Write a snapshot of every registered block in Prometheus text format
+ * Returns the number of bytes written, not counting the terminator
+ */
+size_t metrics_format(char *buf, size_t cap, metrics_extra_fn extra) {
+    uint64_t counters[NUM_COUNTERS] = {0};
+    static uint64_t counts[NUM_STAGES][METRIC_BUCKETS]; // Snapshots are serialized by registry_lock
+    uint64_t sums[NUM_STAGES] = {0};
+    size_t len = 0;
+
+    if (cap == 0) {
+        return 0;
+    }
+    buf[0] = '\0';
+
+    pthread_mutex_lock(&registry_lock);
+    memset(counts, 0, sizeof(counts));
+    for (int i = 0; i < num_blocks; i++) {
+        for (int c = 0; c < NUM_COUNTERS; c++) {
+            counters[c] += atomic_load_explicit(&blocks[i]->counters[c], memory_order_relaxed);
+        }
+        for (int s = 0; s < NUM_STAGES; s++) {
+            const Histogram *h = &blocks[i]->stages[s];
+            for (int b = 0; b < METRIC_BUCKETS; b++) {
+                counts[s][b] += atomic_load_explicit(&h->counts[b], memory_order_relaxed);
+            }
+            sums[s] += atomic_load_explicit(&h->sum_ns, memory_order_relaxed);
+        }
+    }
+
+    for (int c = 0; c < NUM_COUNTERS; c++) {
+        append(buf, cap, &len, "# HELP %s %s\n# TYPE %s counter\n%s %llu\n",
+               counter_info[c].name, counter_info[c].help, counter_info[c].name,
+               counter_info[c].name, (unsigned long long)counters[c]);
+    }
+    append(buf, cap, &len, "# HELP mud_sessions_active Player sessions currently active\n"
+           "# TYPE mud_sessions_active gauge\nmud_sessions_active %llu\n",
+           (unsigned long long)(counters[COUNTER_JOINS] - counters[COUNTER_EVICTIONS]));
+
+    append(buf, cap, &len, "# HELP mud_stage_latency_seconds Time spent in each stage of handling a command\n"
+           "# TYPE mud_stage_latency_seconds histogram\n");
+    for (int s = 0; s < NUM_STAGES; s++) {
+        // Power-of-two bounds fall exactly on bucket boundaries
+        uint64_t cumulative = 0;
+        unsigned b = 0;
+        for (int exp = METRICS_MIN_EXP; exp <= METRICS_MAX_EXP; exp++) {
+            unsigned end = metrics_bucket(1ULL << exp);
+            for (; b < end; b++) {
+                cumulative += counts[s][b];
+            }
+            append(buf, cap, &len, "mud_stage_latency_seconds_bucket{stage=\"%s\",le=\"%.9g\"} %llu\n",
+                   stage_names[s], (double)(1ULL << exp) / 1e9, (unsigned long long)cumulative);
+        }
+        for (; b < METRIC_BUCKETS; b++) {
+            cumulative += counts[s][b];
+        }
+        append(buf, cap, &len, "mud_stage_latency_seconds_bucket{stage=\"%s\",le=\"+Inf\"} %llu\n"
+               "mud_stage_latency_seconds_sum{stage=\"%s\"} %.9f\n"
+               "mud_stage_latency_seconds_count{stage=\"%s\"} %llu\n",
+               stage_names[s], (unsigned long long)cumulative,
+               stage_names[s], sums[s] / 1e9,
+               stage_names[s], (unsigned long long)cumulative);
+    }
+    pthread_mutex_unlock(&registry_lock);
+
+    if (extra && len < cap) {
+        len += extra(buf + len, cap - len);
+    }
+    return len;
+}
+
+/**
+ * Answer every waiting request with a snapshot (control loop only)
+ */
+void metrics_server_handle(void) {
+    static char reply[METRICS_REPLY_SIZE];
+    char request[64];
+    struct sockaddr_in client;
+
+    for (;;) {
+        socklen_t client_len = sizeof(client);
+        ssize_t n = recvfrom(server_fd, request, sizeof(request), 0, (struct sockaddr *)&client, &client_len);
+        if (n < 0) {
+            break; // Nothing more waiting
+        }
+
+        size_t len = metrics_format(reply, sizeof(reply), server_extra);
+        if (sendto(server_fd, reply, len, 0, (struct sockaddr *)&client, client_len) < 0) {
+            ASYNC_LOG(LOG_WARNING, "Could not send metrics snapshot");
+        }
+    }
+}
+
+/**
+ * Open the stats endpoint on 127.0.0.1:port
+ * Returns the socket for the control loop to watch, or -1 on failure
+ */
+int metrics_server_start(int port, metrics_extra_fn extra) {
+    server_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (server_fd < 0) {
+        syslog(LOG_ERR, "Error creating metrics socket");
+        return -1;
+    }
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if (bind(server_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        syslog(LOG_ERR, "Error binding metrics socket to port %d", port);
+        close(server_fd);
+        server_fd = -1;
+        return -1;
+    }
+
+    server_extra = extra;
+    return server_fd;
+}
+
+/**
+ * Close the endpoint
+ */
+void metrics_server_stop(void) {
+    if (server_fd < 0) {
+        return;
+    }
+    close(server_fd);
+    server_fd = -1;
+}
@@ -0,0 +1,118 @@
+/**
+ * metrics.h - Counters and latency histograms
+ *
+ * Each thread that records metrics owns a Metrics block and is its only
+ * writer, so recording is a plain relaxed load and store with no locked
+ * instructions or shared cache lines. The exporter sums every registered
+ * block when it is asked for a snapshot.
+ *
+ * Histograms are log-linear (HDR-style): every power of two is split into
+ * METRIC_SUB_BUCKETS equal buckets, which keeps the relative error under
+ * 1/METRIC_SUB_BUCKETS from nanoseconds up to minutes.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+
+#define METRIC_SUB_BUCKET_BITS 3
+#define METRIC_SUB_BUCKETS (1 << METRIC_SUB_BUCKET_BITS)
+#define METRIC_BUCKETS (64 * METRIC_SUB_BUCKETS)
+#define METRICS_MAX_BLOCKS 256
+
+// Stages of a command, each with its own latency histogram
+typedef enum {
+    STAGE_RECEIVE,    // Kernel receive timestamp to the worker picking the datagram up
+    STAGE_LOOKUP,     // get_player_id()
+    STAGE_MOVEMENT,   // handle_movement()
+    STAGE_FORMAT,     // send_room_description()
+    STAGE_PUBLISH,    // publisher_submit() to the backend accepting the message
+    STAGE_TICK,       // run_tick(): one tick's intents applied and its messages queued
+    NUM_STAGES
+} MetricStage;
+
+typedef enum {
+    COUNTER_DATAGRAMS,
+    COUNTER_TEXT_COMMANDS,
+    COUNTER_BINARY_FRAMES,
+    COUNTER_JOINS,
+    COUNTER_REJECTED_JOINS,
+    COUNTER_MOVES,
+    COUNTER_BLOCKED_MOVES,
+    COUNTER_RESETS,
+    COUNTER_INVALID_COMMANDS,
+    COUNTER_EVICTIONS,
+    COUNTER_RATE_LIMITED,
+    COUNTER_COALESCED_MESSAGES,
+    COUNTER_DROPPED_INTENTS,
+    NUM_COUNTERS
+} MetricCounter;
+
+typedef struct {
+    _Atomic uint64_t counts[METRIC_BUCKETS];
+    _Atomic uint64_t sum_ns;
+} Histogram;
+
+typedef struct {
+    Histogram stages[NUM_STAGES];
+    _Atomic uint64_t counters[NUM_COUNTERS];
+} Metrics;
+
+// Appends extra metric lines to the snapshot; returns the number of bytes written
+typedef size_t (*metrics_extra_fn)(char *buf, size_t cap);
+
+/**
+ * Monotonic time in nanoseconds, for timing stages
+ */
+static inline uint64_t metrics_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Add to a counter (owning thread only)
+ */
+static inline void metrics_add(Metrics *m, MetricCounter counter, uint64_t n) {
+    uint64_t v = atomic_load_explicit(&m->counters[counter], memory_order_relaxed);
+    atomic_store_explicit(&m->counters[counter], v + n, memory_order_relaxed);
+}
+
+static inline void metrics_count(Metrics *m, MetricCounter counter) {
+    metrics_add(m, counter, 1);
+}
+
+/**
+ * Histogram bucket for a value: exact below METRIC_SUB_BUCKETS, log-linear above
+ */
+static inline unsigned metrics_bucket(uint64_t v) {
+    if (v < METRIC_SUB_BUCKETS) {
+        return (unsigned)v;
+    }
+    unsigned exp = 63 - __builtin_clzll(v);
+    unsigned sub = (unsigned)(v >> (exp - METRIC_SUB_BUCKET_BITS)) & (METRIC_SUB_BUCKETS - 1);
+    return (exp - METRIC_SUB_BUCKET_BITS + 1) * METRIC_SUB_BUCKETS + sub;
+}
+
+/**
+ * Record one latency sample in nanoseconds (owning thread only)
+ */
+static inline void metrics_record(Metrics *m, MetricStage stage, uint64_t ns) {
+    Histogram *h = &m->stages[stage];
+    unsigned b = metrics_bucket(ns);
+    atomic_store_explicit(&h->counts[b], atomic_load_explicit(&h->counts[b], memory_order_relaxed) + 1,
+                          memory_order_relaxed);
+    atomic_store_explicit(&h->sum_ns, atomic_load_explicit(&h->sum_ns, memory_order_relaxed) + ns,
+                          memory_order_relaxed);
+}
+
+// Function prototypes
+int metrics_register(Metrics *m);
+size_t metrics_format(char *buf, size_t cap, metrics_extra_fn extra);
+int metrics_server_start(int port, metrics_extra_fn extra);
+void metrics_server_handle(void);
+void metrics_server_stop(void);
+
+#endif /* METRICS_H */
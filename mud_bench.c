@@ -0,0 +1,688 @@
+/**
+ * mud_bench.c - Load generator for mud_server
+ *
+ * Simulates many ESP32 controllers against a local server. Each virtual
+ * controller sends "new" once, then random N/S/E/W moves with an occasional
+ * "reset", exactly like esp32s3_logic. The benchmark also stands in for the
+ * MQTT broker on port 1883, so it sees every message the server publishes
+ * and can time each command from the UDP send to the matching PUBLISH.
+ *
+ * Each controller keeps one command outstanding (closed loop), so every
+ * command produces exactly one publish on that controller's topic.
+ *
+ * With -U the server is expected to run with "-b udp": messages then come
+ * back as datagrams on each controller's own socket and no broker is used.
+ *
+ * Usage: mud_bench [-c controllers] [-d seconds] [-r reset_percent] [-B] [-U] [-P server_pid]
+ *                  [-- server command...]
+ * With a server command, the benchmark starts the server itself once the
+ * broker stand-in is listening, and stops it at the end.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include "protocol.h"
+
+#define SERVER_HOST "127.0.0.1"
+#define SERVER_PORT 8888
+#define BROKER_PORT 1883
+#define TOPIC_PREFIX "mud/player/"
+#define DEFAULT_CONTROLLERS 100
+#define DEFAULT_DURATION 10
+#define DEFAULT_RESET_PERCENT 2
+#define JOIN_TIMEOUT_NS 5000000000ULL
+#define JOIN_RETRY_ROUNDS 10    // Resend unanswered joins every 10 x 50 ms
+#define COMMAND_TIMEOUT_NS 1000000000ULL
+#define MAX_EVENTS 256
+#define BROKER_BUFFER_SIZE 65536
+
+// Where a virtual controller is in its session
+typedef enum {
+    CTRL_JOINING,   // "new" sent, waiting for the UDP reply and first room message
+    CTRL_IDLE,      // Ready to send the next command
+    CTRL_WAITING    // Command sent, waiting for its publish
+} ControllerState;
+
+// One simulated ESP32
+typedef struct {
+    int sock_fd;
+    int player_id;
+    uint32_t token;       // Binary mode only
+    uint32_t sequence;    // Binary mode only
+    ControllerState state;
+    bool room_seen;       // First room message arrived (after the player ID was known)
+    uint64_t sent_at;     // When the outstanding command was sent
+} Controller;
+
+// The server's connection to the broker stand-in
+typedef struct {
+    int fd;
+    unsigned char buf[BROKER_BUFFER_SIZE];
+    size_t len;
+} BrokerConn;
+
+// Configuration
+static int num_controllers = DEFAULT_CONTROLLERS;
+static int duration = DEFAULT_DURATION;
+static int reset_percent = DEFAULT_RESET_PERCENT;
+static bool binary_mode = false;
+static bool udp_mode = false;
+static pid_t server_pid = 0;
+
+// State
+static Controller *controllers;
+static int *controller_of;       // Player ID -> controller index, or -1
+static bool *room_seen;          // Player ID -> room message arrived before the ID was known
+static int id_capacity;
+static int epoll_fd;
+static struct sockaddr_in server_addr;
+static bool measuring = false;
+
+// Results
+static uint64_t *samples;
+static size_t num_samples, samples_cap;
+static uint64_t commands_sent, timeouts, stray_publishes;
+
+/**
+ * Monotonic time in nanoseconds
+ */
+static uint64_t now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/**
+ * Grow the player ID maps to cover id
+ */
+static int ensure_id(int id) {
+    if (id < id_capacity) {
+        return 0;
+    }
+
+    int capacity = id_capacity ? id_capacity : 1024;
+    while (capacity <= id) {
+        capacity *= 2;
+    }
+
+    int *new_controller_of = realloc(controller_of, capacity * sizeof(int));
+    if (!new_controller_of) {
+        return -1;
+    }
+    controller_of = new_controller_of;
+
+    bool *new_room_seen = realloc(room_seen, capacity * sizeof(bool));
+    if (!new_room_seen) {
+        return -1;
+    }
+    room_seen = new_room_seen;
+
+    for (int i = id_capacity; i < capacity; i++) {
+        controller_of[i] = -1;
+        room_seen[i] = false;
+    }
+    id_capacity = capacity;
+    return 0;
+}
+
+/**
+ * Record one command-to-publish latency
+ */
+static void record_sample(uint64_t ns) {
+    if (num_samples == samples_cap) {
+        size_t cap = samples_cap ? samples_cap * 2 : 65536;
+        uint64_t *grown = realloc(samples, cap * sizeof(uint64_t));
+        if (!grown) {
+            return;
+        }
+        samples = grown;
+        samples_cap = cap;
+    }
+    samples[num_samples++] = ns;
+}
+
+/**
+ * Send a binary frame for a controller
+ */
+static void send_frame(Controller *ctrl, uint8_t opcode, uint8_t direction) {
+    MudFrame frame = {
+        .magic = MUD_FRAME_MAGIC,
+        .version = MUD_PROTOCOL_VERSION,
+        .opcode = opcode,
+        .direction = direction,
+        .player_token = htonl(ctrl->token),
+        .sequence = htonl(++ctrl->sequence),
+    };
+    sendto(ctrl->sock_fd, &frame, sizeof(frame), 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+}
+
+/**
+ * Ask the server for a controller's player
+ */
+static void send_join(Controller *ctrl) {
+    if (binary_mode) {
+        send_frame(ctrl, MUD_OP_JOIN, 0);
+    } else {
+        sendto(ctrl->sock_fd, "new", 3, 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    }
+}
+
+/**
+ * Send a controller's next random command and start its clock
+ */
+static void send_command(Controller *ctrl) {
+    static const char directions[] = "NSEW";
+    bool reset = rand() % 100 < reset_percent;
+    int direction = rand() % 4;
+
+    ctrl->state = CTRL_WAITING;
+    ctrl->sent_at = now_ns();
+    commands_sent++;
+
+    if (binary_mode) {
+        send_frame(ctrl, reset ? MUD_OP_RESET : MUD_OP_MOVE, direction);
+    } else if (reset) {
+        sendto(ctrl->sock_fd, "reset", 5, 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    } else {
+        sendto(ctrl->sock_fd, &directions[direction], 1, 0, (struct sockaddr *)&server_addr, sizeof(server_addr));
+    }
+}
+
+/**
+ * A message for a controller's player arrived: complete its command and send the next
+ */
+static void handle_message(Controller *ctrl) {
+    if (ctrl->state == CTRL_JOINING) {
+        ctrl->room_seen = true; // The room message that follows "new"
+        return;
+    }
+    if (ctrl->state != CTRL_WAITING) {
+        stray_publishes++; // Arrived after its command timed out
+        return;
+    }
+
+    if (measuring) {
+        record_sample(now_ns() - ctrl->sent_at);
+    }
+    ctrl->state = CTRL_IDLE;
+    if (measuring) {
+        send_command(ctrl);
+    }
+}
+
+/**
+ * Handle a UDP reply to "new" or JOIN, or in -U mode a published message
+ */
+static void handle_udp(Controller *ctrl) {
+    unsigned char buf[256];
+    ssize_t n;
+
+    while ((n = recv(ctrl->sock_fd, buf, sizeof(buf) - 1, 0)) > 0) {
+        int id = -1;
+
+        if (n == sizeof(MudFrame) && buf[0] == MUD_FRAME_MAGIC) {
+            MudFrame ack;
+            memcpy(&ack, buf, sizeof(ack));
+            if (ack.opcode == MUD_OP_JOIN_ACK) {
+                ctrl->token = ntohl(ack.player_token);
+                id = (int)ntohl(ack.sequence);
+            }
+        } else {
+            buf[n] = '\0';
+            if (sscanf((char *)buf, "player:%d", &id) != 1 && udp_mode) {
+                handle_message(ctrl);
+                continue;
+            }
+        }
+
+        if (id >= 0 && ctrl->player_id < 0 && ensure_id(id) == 0) {
+            ctrl->player_id = id;
+            controller_of[id] = ctrl - controllers;
+        }
+    }
+}
+
+/**
+ * A PUBLISH arrived for a player's topic
+ */
+static void handle_publish(const char *topic, size_t topic_len) {
+    size_t prefix_len = strlen(TOPIC_PREFIX);
+    if (topic_len <= prefix_len || memcmp(topic, TOPIC_PREFIX, prefix_len) != 0) {
+        return;
+    }
+
+    int id = 0;
+    for (size_t i = prefix_len; i < topic_len; i++) {
+        id = id * 10 + (topic[i] - '0');
+    }
+    if (ensure_id(id) != 0) {
+        return;
+    }
+
+    int c = controller_of[id];
+    if (c < 0) {
+        room_seen[id] = true; // Beat the UDP reply carrying the player ID
+        return;
+    }
+    handle_message(&controllers[c]);
+}
+
+/**
+ * Queue bytes to the server's broker connection; it's local, so a blocking write is fine
+ */
+static void broker_send(BrokerConn *conn, const unsigned char *data, size_t len) {
+    while (len > 0) {
+        ssize_t n = write(conn->fd, data, len);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        data += n;
+        len -= n;
+    }
+}
+
+/**
+ * Parse every complete MQTT packet in the connection buffer
+ * Returns -1 if the connection should be closed
+ */
+static int handle_broker(BrokerConn *conn) {
+    ssize_t n = read(conn->fd, conn->buf + conn->len, sizeof(conn->buf) - conn->len);
+    if (n <= 0) {
+        return (n < 0 && errno == EAGAIN) ? 0 : -1;
+    }
+    conn->len += n;
+
+    size_t pos = 0;
+    while (pos + 2 <= conn->len) {
+        // Fixed header: type byte, then variable-length remaining length
+        unsigned char type = conn->buf[pos];
+        size_t remaining = 0, header = 1;
+        int shift = 0;
+        bool complete = false;
+        while (pos + header < conn->len && header <= 4) {
+            unsigned char b = conn->buf[pos + header++];
+            remaining |= (size_t)(b & 0x7F) << shift;
+            shift += 7;
+            if (!(b & 0x80)) {
+                complete = true;
+                break;
+            }
+        }
+        if (!complete || pos + header + remaining > conn->len) {
+            break;
+        }
+
+        const unsigned char *body = conn->buf + pos + header;
+        switch (type >> 4) {
+            case 1: { // CONNECT
+                unsigned char connack[] = { 0x20, 0x02, 0x00, 0x00 };
+                broker_send(conn, connack, sizeof(connack));
+                break;
+            }
+            case 3: { // PUBLISH
+                int qos = (type >> 1) & 3;
+                size_t topic_len = (body[0] << 8) | body[1];
+                handle_publish((const char *)body + 2, topic_len);
+                if (qos > 0) {
+                    const unsigned char *mid = body + 2 + topic_len;
+                    unsigned char ack[] = { qos == 1 ? 0x40 : 0x50, 0x02, mid[0], mid[1] };
+                    broker_send(conn, ack, sizeof(ack));
+                }
+                break;
+            }
+            case 6: { // PUBREL
+                unsigned char pubcomp[] = { 0x70, 0x02, body[0], body[1] };
+                broker_send(conn, pubcomp, sizeof(pubcomp));
+                break;
+            }
+            case 12: { // PINGREQ
+                unsigned char pingresp[] = { 0xD0, 0x00 };
+                broker_send(conn, pingresp, sizeof(pingresp));
+                break;
+            }
+            case 14: // DISCONNECT
+                return -1;
+            default:
+                break;
+        }
+        pos += header + remaining;
+    }
+
+    memmove(conn->buf, conn->buf + pos, conn->len - pos);
+    conn->len -= pos;
+    if (conn->len == sizeof(conn->buf)) {
+        return -1; // Packet larger than the buffer
+    }
+    return 0;
+}
+
+/**
+ * Open the broker stand-in's listening socket
+ */
+static int listen_broker() {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        perror("socket");
+        return -1;
+    }
+
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(BROKER_PORT) };
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        fprintf(stderr, "Could not listen on port %d (is a broker running?): %s\n",
+                BROKER_PORT, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * Run the event loop until deadline, sending commands if measuring
+ */
+static void run_until(uint64_t deadline, int listen_fd, BrokerConn *conn) {
+    struct epoll_event events[MAX_EVENTS];
+
+    while (now_ns() < deadline) {
+        int n = epoll_wait(epoll_fd, events, MAX_EVENTS, 100);
+
+        for (int i = 0; i < n; i++) {
+            uint32_t tag = events[i].data.u32;
+            if (tag == (uint32_t)-1) {
+                // The server connecting to the broker
+                int fd = accept(listen_fd, NULL, NULL);
+                if (fd >= 0) {
+                    if (conn->fd >= 0) {
+                        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+                        close(conn->fd);
+                    }
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    conn->fd = fd;
+                    conn->len = 0;
+                    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)-2 };
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+                }
+            } else if (tag == (uint32_t)-2) {
+                if (handle_broker(conn) != 0) {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, conn->fd, NULL);
+                    close(conn->fd);
+                    conn->fd = -1;
+                }
+            } else {
+                handle_udp(&controllers[tag]);
+            }
+        }
+
+        // Resend commands whose publish never came
+        if (measuring) {
+            uint64_t now = now_ns();
+            for (int c = 0; c < num_controllers; c++) {
+                if (controllers[c].state == CTRL_WAITING && now - controllers[c].sent_at > COMMAND_TIMEOUT_NS) {
+                    timeouts++;
+                    send_command(&controllers[c]);
+                }
+            }
+        }
+    }
+}
+
+/**
+ * Server CPU time so far in clock ticks, from /proc/<pid>/stat
+ */
+static long long server_cpu_ticks() {
+    if (server_pid <= 0) {
+        return -1;
+    }
+
+    char path[64], buf[1024];
+    snprintf(path, sizeof(path), "/proc/%d/stat", (int)server_pid);
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+    size_t n = fread(buf, 1, sizeof(buf) - 1, f);
+    fclose(f);
+    buf[n] = '\0';
+
+    // Fields after the command name: state is field 3, utime 14, stime 15
+    char *p = strrchr(buf, ')');
+    if (!p) {
+        return -1;
+    }
+    unsigned long long utime, stime;
+    if (sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2) {
+        return -1;
+    }
+    return (long long)(utime + stime);
+}
+
+static int compare_u64(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+    return x < y ? -1 : x > y;
+}
+
+/**
+ * Latency at quantile q of the sorted samples, in microseconds
+ */
+static double percentile_us(double q) {
+    size_t i = (size_t)(q * (num_samples - 1));
+    return samples[i] / 1000.0;
+}
+
+int main(int argc, char *argv[]) {
+    int opt;
+    while ((opt = getopt(argc, argv, "c:d:r:BUP:")) != -1) {
+        switch (opt) {
+            case 'c':
+                num_controllers = atoi(optarg);
+                break;
+            case 'd':
+                duration = atoi(optarg);
+                break;
+            case 'r':
+                reset_percent = atoi(optarg);
+                break;
+            case 'B':
+                binary_mode = true;
+                break;
+            case 'U':
+                udp_mode = true;
+                break;
+            case 'P':
+                server_pid = atoi(optarg);
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-c controllers] [-d seconds] [-r reset_percent] [-B] [-U] [-P server_pid]\n"
+                        "       [-- server command...]\n", argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (num_controllers <= 0 || duration <= 0 || reset_percent < 0 || reset_percent > 100) {
+        fprintf(stderr, "Invalid option value\n");
+        return EXIT_FAILURE;
+    }
+
+    // One UDP socket per controller, plus a few spare descriptors
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) == 0 && limit.rlim_cur < (rlim_t)num_controllers + 64) {
+        limit.rlim_cur = limit.rlim_max < (rlim_t)num_controllers + 64 ? limit.rlim_max : (rlim_t)num_controllers + 64;
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    srand(time(NULL));
+
+    epoll_fd = epoll_create1(0);
+    BrokerConn *conn = calloc(1, sizeof(BrokerConn));
+    conn->fd = -1;
+
+    int listen_fd = -1;
+    if (!udp_mode) {
+        listen_fd = listen_broker();
+        if (listen_fd < 0) {
+            return EXIT_FAILURE;
+        }
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = (uint32_t)-1 };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, listen_fd, &ev);
+    }
+
+    // Start the server now that it has a broker to connect to
+    if (optind < argc) {
+        server_pid = fork();
+        if (server_pid == 0) {
+            if (listen_fd >= 0) {
+                close(listen_fd);
+            }
+            execvp(argv[optind], &argv[optind]);
+            perror("execvp");
+            _exit(127);
+        }
+    }
+
+    // Wait for the server's MQTT connection
+    uint64_t deadline = now_ns() + JOIN_TIMEOUT_NS;
+    while (!udp_mode && conn->fd < 0 && now_ns() < deadline) {
+        run_until(now_ns() + 100000000ULL, listen_fd, conn);
+    }
+    if (!udp_mode && conn->fd < 0) {
+        fprintf(stderr, "The server never connected to the broker stand-in on port %d\n", BROKER_PORT);
+        if (optind < argc && server_pid > 0) {
+            kill(server_pid, SIGTERM);
+        }
+        return EXIT_FAILURE;
+    }
+    usleep(200000); // Let the server bind its UDP sockets
+
+    server_addr.sin_family = AF_INET;
+    server_addr.sin_port = htons(SERVER_PORT);
+    inet_pton(AF_INET, SERVER_HOST, &server_addr.sin_addr);
+
+    // Join every controller
+    controllers = calloc(num_controllers, sizeof(Controller));
+    for (int c = 0; c < num_controllers; c++) {
+        Controller *ctrl = &controllers[c];
+        ctrl->sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (ctrl->sock_fd < 0) {
+            perror("socket");
+            return EXIT_FAILURE;
+        }
+        ctrl->player_id = -1;
+        ctrl->state = CTRL_JOINING;
+
+        struct epoll_event uev = { .events = EPOLLIN, .data.u32 = c };
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, ctrl->sock_fd, &uev);
+
+        send_join(ctrl);
+
+        // Don't overrun the server's socket buffer while joining
+        if (c % 256 == 255) {
+            run_until(now_ns() + 1000000ULL, listen_fd, conn);
+        }
+    }
+
+    deadline = now_ns() + JOIN_TIMEOUT_NS;
+    int joined = 0;
+    for (int round = 1; now_ns() < deadline; round++) {
+        run_until(now_ns() + 50000000ULL, listen_fd, conn);
+        joined = 0;
+        for (int c = 0; c < num_controllers; c++) {
+            int id = controllers[c].player_id;
+
+            // A server still building a large world drops joins sent before it binds
+            if (id < 0 && round % JOIN_RETRY_ROUNDS == 0) {
+                send_join(&controllers[c]);
+            }
+            if (id >= 0 && (room_seen[id] || controllers[c].room_seen)) {
+                controllers[c].state = CTRL_IDLE;
+                joined++;
+            }
+        }
+        if (joined == num_controllers) {
+            break;
+        }
+    }
+    if (joined < num_controllers) {
+        fprintf(stderr, "Only %d of %d controllers joined; measuring those\n", joined, num_controllers);
+    }
+
+    // Measure: every joined controller keeps one command in flight
+    long long cpu_before = server_cpu_ticks();
+    uint64_t start = now_ns();
+    measuring = true;
+    for (int c = 0; c < num_controllers; c++) {
+        if (controllers[c].state == CTRL_IDLE) {
+            send_command(&controllers[c]);
+        }
+    }
+    run_until(start + (uint64_t)duration * 1000000000ULL, listen_fd, conn);
+    measuring = false;
+    double elapsed = (now_ns() - start) / 1e9;
+    long long cpu_after = server_cpu_ticks();
+
+    // Report
+    printf("controllers:        %d joined of %d (%s commands, %s replies)\n", joined, num_controllers,
+           binary_mode ? "binary" : "text", udp_mode ? "UDP" : "MQTT");
+    printf("duration:           %.2f s\n", elapsed);
+    printf("commands completed: %zu (%.0f commands/sec)\n", num_samples, num_samples / elapsed);
+    printf("timeouts:           %llu, stray publishes: %llu\n",
+           (unsigned long long)timeouts, (unsigned long long)stray_publishes);
+    if (num_samples > 0) {
+        qsort(samples, num_samples, sizeof(uint64_t), compare_u64);
+        printf("latency (us):       p50 %.1f  p99 %.1f  p999 %.1f  max %.1f\n",
+               percentile_us(0.5), percentile_us(0.99), percentile_us(0.999), percentile_us(1.0));
+    }
+    if (cpu_before >= 0 && cpu_after >= 0 && num_samples > 0) {
+        double cpu_ms = (cpu_after - cpu_before) * 1000.0 / sysconf(_SC_CLK_TCK);
+        printf("server CPU:         %.1f ms total, %.2f ms per 1k commands\n",
+               cpu_ms, cpu_ms * 1000.0 / num_samples);
+    } else {
+        printf("server CPU:         unknown (start the server from mud_bench or pass -P pid)\n");
+    }
+
+    // Stop a server we started
+    if (optind < argc && server_pid > 0) {
+        kill(server_pid, SIGTERM);
+        run_until(now_ns() + 200000000ULL, listen_fd, conn);
+        waitpid(server_pid, NULL, 0);
+    }
+
+    for (int c = 0; c < num_controllers; c++) {
+        close(controllers[c].sock_fd);
+    }
+    if (conn->fd >= 0) {
+        close(conn->fd);
+    }
+    if (listen_fd >= 0) {
+        close(listen_fd);
+    }
+    close(epoll_fd);
+    free(conn);
+    free(controllers);
+    free(controller_of);
+    free(room_seen);
+    free(samples);
+    return EXIT_SUCCESS;
+}
@@ -7,6 +7,7 @@
  * using MQTT. The program runs as a background service on a GCP VM instance.
  */
 
+#define _GNU_SOURCE
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -14,101 +15,272 @@
 #include <stdbool.h>
 #include <time.h>
 #include <signal.h>
+#include <pthread.h>
+#include <sched.h>
+#include <errno.h>
+#include <stdatomic.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
-#include <mosquitto.h>
 #include <syslog.h>
 #include "rooms.h"
+#include "player_table.h"
+#include "udp_batch.h"
+#include "udp_uring.h"
+#include "payload_cache.h"
+#include "async_log.h"
+#include "publisher.h"
+#include "publish_backend.h"
+#include "protocol.h"
+#include "timer_wheel.h"
+#include "world.h"
+#include "rng.h"
+#include "world_image.h"
+#include "world_check.h"
+#include "world_gen.h"
+#include "metrics.h"
 
 #define UDP_PORT 8888
-#define MAX_BUFFER_SIZE 1024
-#define MAX_PLAYERS 10
-#define MAX_BUILDINGS 4
+#define DEFAULT_MAX_PLAYERS 1024
+#define DEFAULT_WORKERS 1
+#define DEFAULT_IDLE_TIMEOUT 600   // Seconds without a command before a session is evicted
+#define IDLE_CHECK_INTERVAL 1      // Seconds between idle-session sweeps while players are connected
+#define PUBLISH_BUDGET 256         // Messages the control loop publishes between polls
+#define SHUTDOWN_DRAIN_MS 1000     // How long shutdown waits for queued messages to go out
+#define DEFAULT_METRICS_PORT 8889  // Stats endpoint on 127.0.0.1
+#define DEFAULT_COMMAND_RATE 0     // Commands per second each player may sustain (0: unlimited)
+#define DEFAULT_COMMAND_BURST 10   // Commands a player may send at once after a pause
+#define TICK_INTENTS_PER_PLAYER 8  // Queued moves and resets a tick holds per player slot
+#define WORKER_OFFLINE UINT64_MAX  // seen_generation of a worker blocked in epoll
+#define RETIRE_POLL_MS 10          // How often the control loop checks on replaced worlds
+#define MAX_WORKERS (METRICS_MAX_BLOCKS - 1) // Each worker's metrics take a block, as do the publisher's
 
-// MQTT Configuration
-#define MQTT_HOST "localhost"
-#define MQTT_PORT 1883
+// Publishing Configuration
+#define DEFAULT_BACKEND "mqtt"
 #define MQTT_TOPIC_PREFIX "mud/player/"
-#define MQTT_QOS 1
-#define MQTT_KEEPALIVE 60
+#define DEFAULT_ROOM_QOS 1     // Room descriptions must arrive
+#define DEFAULT_ERROR_QOS 0    // Errors are superseded by the next move anyway
+#define DEFAULT_MAX_INFLIGHT 100
 
 // Player structure
 typedef struct {
     int id;
-    int current_building;
-    int current_room;
     struct sockaddr_in addr;
+    _Atomic uint64_t reply_addr; // addr packed for the control loop by pack_reply_addr(), 0 while inactive
     char mqtt_topic[100];
     bool is_active;
+    uint32_t token;          // Binary protocol: must match every frame after JOIN
+    uint32_t last_sequence;  // Binary protocol: highest frame sequence applied
+    uint32_t last_active;    // session_clock() time of the player's last command
+    int world;               // The player's game layout, in the worker's world pool
+    uint64_t next_command_at; // Rate limit: when the player's bucket is next full (metrics_now() ns)
+    const Payload *outbox;   // Last message for the player in this batch, NULL if none
+    int outbox_building;     // Logical building its header names
 } Player;
 
-// Global variables
-Room buildings[MAX_BUILDINGS][MAX_ROOMS];
-Player players[MAX_PLAYERS];
-int num_players = 0;
-int sock_fd;
-struct mosquitto *mosq = NULL;
-bool running = true;
-int building_order[MAX_BUILDINGS]; // Maps logical building ID to physical array index
-
-// Each team member's room initialization functions
-extern void initialize_rooms_building1(Room rooms[]); // Julian's rooms
-extern void initialize_rooms_building2(Room rooms[]); // Tyler's rooms
-extern void initialize_rooms_building3(Room rooms[]); // Ally's rooms
-extern void initialize_rooms_building4(Room rooms[]); // Umar's rooms
+// Event sources, stored in epoll_event.data.u32
+enum {
+    EVENT_SOCKET,     // Worker: datagrams waiting
+    EVENT_TIMER,      // Worker: idle sweep due
+    EVENT_WAKE,       // Worker: shutdown requested
+    EVENT_SIM_TICK,   // Worker: simulation tick due (-T)
+    EVENT_SIGNAL,     // Control: SIGINT/SIGTERM, or SIGHUP to reload the world
+    EVENT_PUBLISHER,  // Control: messages queued for publishing
+    EVENT_BACKEND,    // Control: publish backend socket ready
+    EVENT_METRICS,    // Control: stats request
+    EVENT_TICK,       // Control: once-a-second backend housekeeping
+    EVENT_RELOAD,     // Control: the reload thread has loaded a world
+    EVENT_RETIRE      // Control: time to check whether replaced worlds can be freed
+};
 
-// Function prototypes
-void initialize_buildings();
-void randomize_building_order();
-void process_command(char *buffer, struct sockaddr_in client_addr);
-void handle_movement(int player_id, char direction);
-void send_room_description(int player_id);
-void publish_mqtt_message(const char *topic, const char *message);
-void mosquitto_log_callback(struct mosquitto *mosq, void *obj, int level, const char *str);
-void signal_handler(int sig);
-int get_player_id(struct sockaddr_in addr);
-void add_player(struct sockaddr_in addr);
-void send_udp_response(struct sockaddr_in addr, const char* message);
-
-/**
- * Initialize the MQTT client
- */
-int initialize_mqtt() {
-    mosquitto_lib_init();
-    mosq = mosquitto_new(NULL, true, NULL);
-    if (!mosq) {
-        syslog(LOG_ERR, "Error: Out of memory when creating MQTT client");
-        return -1;
-    }
+// One loaded world: everything workers read about the rooms. A reload builds a
+// new one and swaps it in whole; the old one is freed once nothing can use it.
+typedef struct WorldData {
+    RoomMap map;                                // Rooms and exits, in one of the three below
+    StringArena strings;                        // Descriptions; borrowed with -W and -G
+    PayloadCache payloads;
+    WorldImage image;                           // Mapping map points into, with -W
+    GeneratedWorld generated;                   // World map points into, with -G
+    RoomRecord compiled_rooms[MAX_BUILDINGS * MAX_ROOMS]; // Built-in buildings, otherwise
+    RoomExits compiled_exits[MAX_BUILDINGS * MAX_ROOMS];
+    RoomIndex index;                            // Start rooms and connector targets of map
+    uint64_t generation;
+    size_t retire_mark;                         // Publisher queue position to pass before freeing
+    struct WorldData *next_retired;
+} WorldData;
 
-    mosquitto_log_callback_set(mosq, mosquitto_log_callback);
+// A move or reset waiting for the next simulation tick
+#define INTENT_RESET NUM_DIRECTIONS   // Other intents are directions
+typedef struct {
+    int32_t player_id;
+    uint32_t token;          // Session that sent it; skipped if the slot changed hands
+    int32_t op;              // DIR_* or INTENT_RESET
+} Intent;
 
-    int rc = mosquitto_connect(mosq, MQTT_HOST, MQTT_PORT, MQTT_KEEPALIVE);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        syslog(LOG_ERR, "Error: Could not connect to MQTT broker: %s", mosquitto_strerror(rc));
-        return -1;
-    }
+// What a tick's intents did to a player, for the messages it gets; flags,
+// since one tick can move a player and then hit a wall
+enum {
+    TICK_UNTOUCHED = 0,
+    TICK_MOVED = 1 << 0,
+    TICK_BLOCKED = 1 << 1
+};
 
-    rc = mosquitto_loop_start(mosq);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        syslog(LOG_ERR, "Error: Could not start MQTT loop: %s", mosquitto_strerror(rc));
-        return -1;
-    }
+// Worker structure - one thread with its own SO_REUSEPORT socket and shard of players.
+// The kernel hashes each client's address to the same socket every time, so a
+// player's packets always reach the worker that owns its session.
+typedef struct {
+    int index;
+    pthread_t thread;
+    int sock_fd;
+    int epoll_fd;              // Watches sock_fd (or the io_uring), timer_fd, tick_fd and wake_fd
+    int timer_fd;              // Idle sweep; armed only while players are connected
+    int tick_fd;               // Simulation tick with -T; armed only while players are connected
+    int wake_fd;               // eventfd written by main() to stop the worker
+    bool timer_armed;
+    bool tick_armed;
+    Player *players;           // This worker's slice of all_players
+    // Player positions, indexed like players and kept as separate arrays so
+    // a tick's moves only touch these
+    int *current_building;
+    int *current_room;
+    int max_players;
+    int num_players;           // Active sessions
+    int next_unused;           // Slots below this have been handed out at least once
+    int *free_slots;           // Slots released by evicted sessions
+    int num_free;
+    uint64_t evicted;          // Sessions evicted for idling
+    uint32_t now;              // session_clock() at the start of the current batch
+    TimerWheel idle_timers;    // One idle deadline per active player
+    PlayerTable player_table;  // (address, port) -> index in players
+    WorldPool worlds;          // Game layouts of this worker's players
+    Rng rng;                   // Session tokens
+    int lobby_world;           // Layout new players join; the worker holds a reference
+    UdpBatch rx_batch;         // Datagrams drained by one recvmmsg()
+    UdpBatch tx_batch;         // Replies sent by one sendmmsg()
+    bool use_uring;            // Receive and send through uring instead, with -u
+    UdpUring uring;
+    int *outbox_players;       // Players with a message in their outbox this batch
+    int num_outbox;
+    uint64_t batch_time;       // metrics_now() at the start of the current batch
+    Intent *intents;           // Moves and resets queued for the next tick, in arrival order
+    int num_intents;
+    int max_intents;
+    uint8_t *tick_result;      // TICK_* flags per player for the tick being applied
+    int *tick_players;         // Players the tick touched
+    Metrics metrics;           // Written only by this worker's thread
+    const WorldData *data;     // World in use for the current batch
+    atomic_uint_fast64_t seen_generation; // world_generation when data was read, WORKER_OFFLINE while idle
+} Worker;
 
-    return 0;
-}
+// Global variables
+_Atomic(WorldData *) world_data = NULL;       // Current world; replaced on SIGHUP
+atomic_uint_fast64_t world_generation = 0;    // Bumped after each replacement
+WorldData *grace_worlds = NULL;               // Replaced worlds a worker may still be reading (control thread only)
+WorldData *retired_worlds = NULL;             // Replaced worlds queued messages may still point into (control thread only)
+pthread_t reload_thread;
+bool reload_running = false;                  // reload_thread is loading a world (control thread only)
+bool reload_again = false;                    // SIGHUP arrived during that load
+WorldData *reloaded_world = NULL;             // reload_thread's result, NULL if the load failed
+int reload_fd = -1;                           // eventfd reload_thread signals when it is done
+const char *world_path = NULL;                // Set with -W
+int generate_buildings = 0;                   // Set with -G, 0 unless generating
+int generate_rooms = 0;
+Player *all_players = NULL;
+int max_players = DEFAULT_MAX_PLAYERS; // Set with -m
+Worker *workers = NULL;
+int num_workers = DEFAULT_WORKERS;     // Set with -w, 0 means one per core
+const PublishBackend *backend = NULL;   // Set with -b
+int room_qos = DEFAULT_ROOM_QOS;          // Set with -q
+int error_qos = DEFAULT_ERROR_QOS;        // Set with -e
+int max_inflight = DEFAULT_MAX_INFLIGHT;  // Set with -i
+int idle_timeout = DEFAULT_IDLE_TIMEOUT;  // Set with -t, 0 disables eviction
+int metrics_port = DEFAULT_METRICS_PORT;  // Set with -M, 0 disables the stats endpoint
+bool uring_mode = false;                  // Set with -u
+int command_rate = DEFAULT_COMMAND_RATE;  // Set with -r, 0 disables rate limiting
+int command_burst = DEFAULT_COMMAND_BURST; // Set with -B
+int tick_ms = 0;                          // Set with -T, 0 applies commands as they arrive
+uint64_t world_seed;                      // Set with -S; every generator derives from it
+bool world_seed_set = false;
+volatile sig_atomic_t running = true;
+
+// Each team member's room initialization and exit functions
+static const struct {
+    void (*initialize_rooms)(Room rooms[]);
+    next_room_fn get_next_room;
+} building_modules[MAX_BUILDINGS] = {
+    { initialize_rooms_building1, get_next_room_building1 }, // Julian's rooms
+    { initialize_rooms_building2, get_next_room_building2 }, // Tyler's rooms
+    { initialize_rooms_building3, get_next_room_building3 }, // Ally's rooms
+    { initialize_rooms_building4, get_next_room_building4 }, // Umar's rooms
+};
+
+// Messages that don't depend on the room
+static const Payload cant_go_payload =
+    PAYLOAD_LITERAL("You can't go that way. Try another direction.", PAYLOAD_ERROR);
+static const Payload invalid_command_payload =
+    PAYLOAD_LITERAL("Invalid command. Use N, S, E, W to move.", PAYLOAD_ERROR);
+
+// Function prototypes
+WorldData *load_world_data();
+int load_world_image(WorldData *data, const char *path);
+int compile_buildings(WorldData *data);
+int generate_world(WorldData *data);
+void free_world_data(WorldData *data);
+void *reload_main(void *arg);
+void start_reload();
+void finish_reload();
+void retire_worlds();
+void free_retired_worlds(bool all);
+void worker_sync_world(Worker *worker);
+void remap_players(Worker *worker);
+void randomize_building_order(Worker *worker, int world_id);
+World *player_world(Worker *worker, const Player *player);
+void process_command(Worker *worker, char *buffer, int len, struct sockaddr_in client_addr);
+void process_frames(Worker *worker, const char *buffer, int len, struct sockaddr_in client_addr);
+void send_join_ack(Worker *worker, struct sockaddr_in addr, const Player *player);
+void reset_player(Worker *worker, int player_id);
+void handle_movement(Worker *worker, int player_id, int direction);
+bool apply_move(Worker *worker, int player_id, int direction);
+void submit_intent(Worker *worker, int player_id, int op);
+void run_tick(Worker *worker);
+void send_room_description(Worker *worker, int player_id);
+void queue_message(Worker *worker, int player_id, const Payload *payload, int logical_building);
+void flush_outbox(Worker *worker);
+bool take_command_token(Worker *worker, Player *player);
+const char *player_topic(int player_id);
+uint64_t pack_reply_addr(const struct sockaddr_in *addr);
+int player_reply_to(int player_id, struct sockaddr_in *addr);
+int get_player_id(Worker *worker, struct sockaddr_in addr);
+int add_player(Worker *worker, struct sockaddr_in addr);
+void evict_player(Worker *worker, int player_id);
+void idle_timer_expired(int player_id, void *ctx);
+uint32_t session_clock();
+size_t format_server_metrics(char *buf, size_t cap);
+void control_loop(sigset_t *signals);
+void send_player_id(Worker *worker, struct sockaddr_in addr, const Player *player);
 
 /**
- * Initialize the UDP socket
+ * Initialize a worker's UDP socket
+ * Every worker binds its own socket to the same port with SO_REUSEPORT
  */
-int initialize_socket() {
-    sock_fd = socket(AF_INET, SOCK_DGRAM, 0);
+int initialize_socket(Worker *worker) {
+    int sock_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
     if (sock_fd < 0) {
         syslog(LOG_ERR, "Error creating socket");
         return -1;
     }
 
+    int reuse = 1;
+    if (setsockopt(sock_fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse)) < 0) {
+        syslog(LOG_ERR, "Error setting SO_REUSEPORT on socket");
+        close(sock_fd);
+        return -1;
+    }
+
     struct sockaddr_in server_addr;
     memset(&server_addr, 0, sizeof(server_addr));
     server_addr.sin_family = AF_INET;
@@ -121,384 +293,1477 @@ int initialize_socket() {
         return -1;
     }
 
+    // Stamp datagrams on arrival for the receive latency histogram
+    if (udp_batch_enable_timestamps(sock_fd) < 0) {
+        syslog(LOG_WARNING, "Could not enable receive timestamps on socket");
+    }
+
+    worker->sock_fd = sock_fd;
+    return 0;
+}
+
+/**
+ * Create a worker's epoll set: its socket, idle sweep timer and shutdown
+ * eventfd. With -u the socket's io_uring stands in for the socket, unless
+ * the kernel can't provide one.
+ */
+int initialize_worker_events(Worker *worker) {
+    worker->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    worker->timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    worker->tick_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    worker->wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (worker->epoll_fd < 0 || worker->timer_fd < 0 || worker->tick_fd < 0 || worker->wake_fd < 0) {
+        syslog(LOG_ERR, "Error creating event descriptors for worker %d", worker->index);
+        return -1;
+    }
+    
+    worker->use_uring = uring_mode && udp_uring_init(&worker->uring, worker->sock_fd) == 0;
+    if (uring_mode && !worker->use_uring) {
+        syslog(LOG_WARNING, "Worker %d: falling back to recvmmsg/sendmmsg", worker->index);
+    }
+    
+    struct { int fd; uint32_t tag; } sources[] = {
+        { worker->use_uring ? worker->uring.ring_fd : worker->sock_fd, EVENT_SOCKET },
+        { worker->timer_fd, EVENT_TIMER },
+        { worker->tick_fd, EVENT_SIM_TICK },
+        { worker->wake_fd, EVENT_WAKE },
+    };
+    for (size_t i = 0; i < sizeof(sources) / sizeof(sources[0]); i++) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = sources[i].tag };
+        if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, sources[i].fd, &ev) < 0) {
+            syslog(LOG_ERR, "Error adding descriptor to worker %d's epoll set", worker->index);
+            return -1;
+        }
+    }
     return 0;
 }
 
 /**
- * Randomizes the building order
- * This shuffles the logical-to-physical mapping of buildings
+ * Start the worker's io_uring receive from the worker's own thread, or go
+ * back to watching the socket if the kernel rejects it
+ */
+void start_worker_uring(Worker *worker) {
+    if (!worker->use_uring || udp_uring_start(&worker->uring) == 0) {
+        return;
+    }
+    
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = EVENT_SOCKET };
+    epoll_ctl(worker->epoll_fd, EPOLL_CTL_DEL, worker->uring.ring_fd, NULL);
+    udp_uring_free(&worker->uring);
+    worker->use_uring = false;
+    if (epoll_ctl(worker->epoll_fd, EPOLL_CTL_ADD, worker->sock_fd, &ev) < 0) {
+        ASYNC_LOG(LOG_ERR, "Worker %d: cannot watch its socket", worker->index);
+        return;
+    }
+    ASYNC_LOG(LOG_WARNING, "Worker %d: falling back to recvmmsg/sendmmsg", worker->index);
+}
+
+/**
+ * Run the idle sweep timer only while the worker has players, so an empty
+ * server never wakes up
+ */
+void update_idle_timer(Worker *worker) {
+    bool want = idle_timeout > 0 && worker->num_players > 0;
+    if (want == worker->timer_armed) {
+        return;
+    }
+    
+    struct itimerspec spec = {0};
+    if (want) {
+        spec.it_value.tv_sec = IDLE_CHECK_INTERVAL;
+        spec.it_interval.tv_sec = IDLE_CHECK_INTERVAL;
+    }
+    timerfd_settime(worker->timer_fd, 0, &spec, NULL);
+    worker->timer_armed = want;
+}
+
+/**
+ * Run the simulation tick only in tick mode and while the worker has
+ * players; queued intents left when the last player goes are dropped
  */
-void randomize_building_order() {
-    // Initialize with default order
-    for (int i = 0; i < MAX_BUILDINGS; i++) {
-        building_order[i] = i;
+void update_tick_timer(Worker *worker) {
+    bool want = tick_ms > 0 && worker->num_players > 0;
+    if (want == worker->tick_armed) {
+        return;
     }
     
-    // Fisher-Yates shuffle
-    for (int i = MAX_BUILDINGS - 1; i > 0; i--) {
-        int j = rand() % (i + 1);
-        int temp = building_order[i];
-        building_order[i] = building_order[j];
-        building_order[j] = temp;
+    struct itimerspec spec = {0};
+    if (want) {
+        spec.it_value.tv_sec = tick_ms / 1000;
+        spec.it_value.tv_nsec = (tick_ms % 1000) * 1000000L;
+        spec.it_interval = spec.it_value;
+    } else {
+        worker->num_intents = 0;
     }
+    timerfd_settime(worker->tick_fd, 0, &spec, NULL);
+    worker->tick_armed = want;
+}
+
+/**
+ * Randomizes one world's building order
+ * This shuffles the logical-to-physical mapping of buildings for the players in that world only
+ */
+void randomize_building_order(Worker *worker, int world_id) {
+    World *world = &worker->worlds.worlds[world_id];
+    world_shuffle(world);
     
     // Log the new order
-    char order_str[100] = "";
-    for (int i = 0; i < MAX_BUILDINGS; i++) {
-        char temp[20];
-        sprintf(temp, "B%d->pos%d ", i+1, building_order[i]+1);
-        strcat(order_str, temp);
+    char order_str[100];
+    world_describe(world, order_str, sizeof(order_str));
+    ASYNC_LOG(LOG_INFO, "Worker %d world %d new building order: %s", worker->index, world_id, order_str);
+}
+
+/**
+ * The world a player is in
+ */
+World *player_world(Worker *worker, const Player *player) {
+    return &worker->worlds.worlds[player->world];
+}
+
+/**
+ * Release a loaded world; no worker or queued message may still use it
+ */
+void free_world_data(WorldData *data) {
+    payload_cache_free(&data->payloads);
+    room_index_free(&data->index);
+    string_arena_free(&data->strings);
+    world_image_unmap(&data->image);
+    world_gen_free(&data->generated);
+    free(data);
+}
+
+/**
+ * Use the rooms, exits and descriptions in a compiled world image
+ * The server points straight into the read-only mapping; nothing is copied
+ */
+int load_world_image(WorldData *data, const char *path) {
+    if (world_image_map(&data->image, path) != 0) {
+        return -1;
+    }
+    
+    data->map = data->image.map;
+    string_arena_attach(&data->strings, data->image.strings, data->image.strings_size,
+                        data->image.header->string_count);
+    
+    syslog(LOG_INFO, "World image %s mapped: %zu bytes, %zu unique descriptions in %zu bytes",
+           path, data->image.size, data->strings.count, data->strings.len);
+    return 0;
+}
+
+/**
+ * Initialize all buildings and their rooms by calling each team member's init function,
+ * then compile each building's exits into the transition table
+ */
+int compile_buildings(WorldData *data) {
+    // Each module fills in full Room structs; they are only needed until compiled
+    Room *staging = malloc(MAX_ROOMS * sizeof(Room));
+    if (!staging || string_arena_init(&data->strings) != 0) {
+        syslog(LOG_ERR, "Error: Out of memory initializing buildings");
+        free(staging);
+        return -1;
+    }
+    
+    for (int b = 0; b < MAX_BUILDINGS; b++) {
+        memset(staging, 0, MAX_ROOMS * sizeof(Room));
+        building_modules[b].initialize_rooms(staging);
+        build_building_exits(&data->compiled_exits[b * MAX_ROOMS], b, building_modules[b].get_next_room);
+        
+        for (int r = 0; r < MAX_ROOMS; r++) {
+            if (compile_room_record(&data->compiled_rooms[b * MAX_ROOMS + r], &staging[r], &data->strings) != 0) {
+                syslog(LOG_ERR, "Error: Out of memory storing room descriptions");
+                free(staging);
+                return -1;
+            }
+        }
+    }
+    
+    free(staging);
+    string_arena_seal(&data->strings);
+    data->map.num_buildings = MAX_BUILDINGS;
+    data->map.rooms_per_building = MAX_ROOMS;
+    data->map.rooms = data->compiled_rooms;
+    data->map.exits = data->compiled_exits;
+    
+    syslog(LOG_INFO, "All buildings and rooms initialized: %zu room bytes, %zu unique descriptions in %zu bytes",
+           sizeof(data->compiled_rooms), data->strings.count, data->strings.len);
+    return 0;
+}
+
+/**
+ * Generate the world asked for with -G from the world seed
+ */
+int generate_world(WorldData *data) {
+    if (world_gen_build(&data->generated, generate_buildings, generate_rooms, world_seed) != 0) {
+        return -1;
+    }
+    
+    data->map = data->generated.map;
+    string_arena_attach(&data->strings, data->generated.strings.data, data->generated.strings.len,
+                        data->generated.strings.count);
+    
+    syslog(LOG_INFO, "World generated: %d buildings of %d rooms, %zu room bytes, %zu unique descriptions in %zu bytes",
+           generate_buildings, generate_rooms, room_map_size(&data->map) * (sizeof(RoomRecord) + sizeof(RoomExits)),
+           data->strings.count, data->strings.len);
+    return 0;
+}
+
+/**
+ * Load the world: the built-in buildings, the world image given with -W or
+ * a world generated with -G, plus every room's description message
+ * formatted up front
+ * Returns NULL on failure
+ */
+WorldData *load_world_data() {
+    WorldData *data = calloc(1, sizeof(WorldData));
+    if (!data) {
+        syslog(LOG_ERR, "Error: Out of memory loading the world");
+        return NULL;
+    }
+    
+    int status = world_path ? load_world_image(data, world_path) :
+                 generate_buildings ? generate_world(data) : compile_buildings(data);
+    if (status == 0) {
+        status = build_room_index(&data->index, &data->map);
+    }
+    if (status == 0 && world_check(&data->map) < 0) {
+        status = -1;
+    }
+    if (status == 0) {
+        status = payload_cache_init(&data->payloads, &data->map, &data->strings);
+    }
+    if (status != 0) {
+        free_world_data(data);
+        return NULL;
+    }
+    return data;
+}
+
+/**
+ * Reload thread: build the next world beside the current one, so the
+ * control loop keeps publishing while a large world loads and is checked
+ */
+void *reload_main(void *arg) {
+    reloaded_world = load_world_data();
+    uint64_t one = 1;
+    if (write(reload_fd, &one, sizeof(one)) < 0) {
+        syslog(LOG_ERR, "Could not signal the end of a world reload");
     }
-    syslog(LOG_INFO, "New building order: %s", order_str);
+    return NULL;
 }
 
 /**
- * Initialize all buildings and their rooms by calling each team member's init function
+ * SIGHUP: start loading the world again (control thread only)
+ * A SIGHUP during a reload starts another one once it is done
  */
-void initialize_buildings() {
-    // Call each team member's initialization function
-    initialize_rooms_building1(buildings[0]);
-    initialize_rooms_building2(buildings[1]);
-    initialize_rooms_building3(buildings[2]);
-    initialize_rooms_building4(buildings[3]);
+void start_reload() {
+    if (reload_running) {
+        reload_again = true;
+        return;
+    }
+    if (pthread_create(&reload_thread, NULL, reload_main, NULL) != 0) {
+        syslog(LOG_ERR, "World reload failed: could not start the reload thread");
+        return;
+    }
+    reload_running = true;
+}
+
+/**
+ * The reload thread is done: swap its world in without stopping the workers
+ * Workers never lock anything to read the world; instead the old world
+ * waits in grace_worlds until every worker has passed a quiescent point,
+ * and then in retired_worlds until the publisher has sent every message
+ * that may point into its payload cache (control thread only)
+ */
+void finish_reload() {
+    pthread_join(reload_thread, NULL);
+    reload_running = false;
     
-    // Randomize the building order
-    randomize_building_order();
+    WorldData *old = atomic_load(&world_data);
+    WorldData *data = reloaded_world;
+    reloaded_world = NULL;
+    if (!data) {
+        syslog(LOG_ERR, "World reload failed, still using generation %llu", (unsigned long long)old->generation);
+    } else if (data->map.num_buildings != old->map.num_buildings) {
+        // Every game layout in the world pools is sized for the first world's buildings
+        syslog(LOG_ERR, "World reload failed: %s has %d buildings instead of %d; restart the server to change that",
+               world_path ? world_path : "the world", data->map.num_buildings, old->map.num_buildings);
+        free_world_data(data);
+    } else {
+        data->generation = old->generation + 1;
+        atomic_store(&world_data, data);
+        atomic_store(&world_generation, data->generation);
+        
+        old->next_retired = grace_worlds;
+        grace_worlds = old;
+        retire_worlds();
+        
+        syslog(LOG_INFO, "World reloaded from %s: generation %llu",
+               world_path ? world_path : "the built-in buildings", (unsigned long long)data->generation);
+    }
     
-    syslog(LOG_INFO, "All buildings and rooms initialized with randomized order");
+    if (reload_again) {
+        reload_again = false;
+        start_reload();
+    }
 }
 
 /**
- * Get player ID by address
+ * Move replaced worlds that every worker has moved past from grace_worlds
+ * to retired_worlds, then free those the publisher is done with (control
+ * thread only). Called from the control loop until both lists are empty.
  */
-int get_player_id(struct sockaddr_in addr) {
-    for (int i = 0; i < num_players; i++) {
-        if (players[i].is_active && 
-            players[i].addr.sin_addr.s_addr == addr.sin_addr.s_addr && 
-            players[i].addr.sin_port == addr.sin_port) {
-            return i;
+void retire_worlds() {
+    WorldData **link = &grace_worlds;
+    while (*link) {
+        WorldData *data = *link;
+        
+        // A worker is past the old world once it is idle or has started a batch since the swap
+        bool passed = true;
+        for (int w = 0; w < num_workers && passed; w++) {
+            uint64_t seen = atomic_load(&workers[w].seen_generation);
+            passed = seen == WORKER_OFFLINE || seen > data->generation;
         }
+        if (!passed) {
+            link = &data->next_retired;
+            continue;
+        }
+        
+        // Messages queued during old batches may still point into the old payload cache
+        *link = data->next_retired;
+        data->retire_mark = publisher_queue_mark();
+        data->next_retired = retired_worlds;
+        retired_worlds = data;
     }
-    return -1;
+    free_retired_worlds(false);
 }
 
 /**
- * Send a UDP response to a client
+ * Free replaced worlds that nothing can reference any more (control thread only)
+ * With all set, free every one, in grace_worlds too; used at shutdown once
+ * the workers have stopped and the publisher is done
  */
-void send_udp_response(struct sockaddr_in addr, const char* message) {
-    sendto(sock_fd, message, strlen(message), 0, 
-           (struct sockaddr *)&addr, sizeof(addr));
+void free_retired_worlds(bool all) {
+    while (all && grace_worlds) {
+        WorldData *data = grace_worlds;
+        grace_worlds = data->next_retired;
+        free_world_data(data);
+    }
+    
+    WorldData **link = &retired_worlds;
+    while (*link) {
+        WorldData *data = *link;
+        if (all || publisher_queue_passed(data->retire_mark)) {
+            *link = data->next_retired;
+            free_world_data(data);
+        } else {
+            link = &data->next_retired;
+        }
+    }
+}
+
+/**
+ * Seconds on the monotonic clock; session timestamps are kept at this resolution
+ */
+uint32_t session_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec;
+}
+
+/**
+ * Get player ID by address, marking the session as active
+ */
+int get_player_id(Worker *worker, struct sockaddr_in addr) {
+    uint64_t start = metrics_now();
+    int player_id = player_table_lookup(&worker->player_table, &addr);
+    if (player_id >= 0) {
+        worker->players[player_id].last_active = worker->now;
+    }
+    metrics_record(&worker->metrics, STAGE_LOOKUP, metrics_now() - start);
+    return player_id;
+}
+
+/**
+ * Queue the "player:<id>" reply to a text "new"; it is sent when the current
+ * batch is flushed. The fixed text is sent from where it lies and only the
+ * digits are written into the batch.
+ */
+void send_player_id(Worker *worker, struct sockaddr_in addr, const Player *player) {
+    static const char prefix[] = "player:";
+    char digits[10];
+    size_t len = payload_append_number(digits, (uint32_t)player->id) - digits;
+    udp_batch_queue_frame(&worker->tx_batch, worker->sock_fd, &addr, NULL, 0,
+                          prefix, sizeof(prefix) - 1, digits, len);
 }
 
 /**
  * Add a new player
+ * Returns the player's index in the worker's shard, or -1 if rejected
  */
-void add_player(struct sockaddr_in addr) {
-    if (num_players < MAX_PLAYERS) {
+int add_player(Worker *worker, struct sockaddr_in addr) {
+    if (worker->num_players < worker->max_players) {
+        // Reuse an evicted session's slot before touching a fresh one
+        int player_id = worker->num_free > 0 ? worker->free_slots[worker->num_free - 1]
+                                             : worker->next_unused;
+        Player *player = &worker->players[player_id];
+        
+        // New players join the worker's lobby layout
+        int world_id = worker->lobby_world;
+        World *world = &worker->worlds.worlds[world_id];
+        
         // Pick a random logical building
-        int logical_building = rand() % MAX_BUILDINGS;
+        int logical_building = rng_below(&world->rng, worker->data->map.num_buildings);
         
-        // Convert to physical building using the building order
-        int physical_building = building_order[logical_building];
+        // Convert to physical building using the world's building order
+        int physical_building = world_physical(world, logical_building);
         
-        int room_idx = -1;
+        // player->id was assigned when the shard was carved out of all_players
+        player->addr = addr;
+        worker->current_building[player_id] = physical_building;
+        worker->current_room[player_id] = room_index_entry(&worker->data->index, physical_building);
+        player->is_active = true;
+        player->token = (uint32_t)rng_next(&worker->rng) | 1; // Never 0
+        player->last_sequence = 0;
+        player->last_active = worker->now;
+        player->world = world_id;
+        player->next_command_at = 0;
         
-        // Find a start room in that building
-        for (int i = 0; i < MAX_ROOMS; i++) {
-            if (buildings[physical_building][i].is_start_room) {
-                room_idx = i;
-                break;
-            }
+        if (player_table_insert(&worker->player_table, &addr, player_id) != 0) {
+            ASYNC_LOG(LOG_ERR, "Error: Could not index player %d, connection rejected", player->id);
+            player->is_active = false;
+            return -1;
         }
+        atomic_store_explicit(&player->reply_addr, pack_reply_addr(&addr), memory_order_release);
         
-        if (room_idx == -1) {
-            // If no start room found, use room 1
-            room_idx = 0;
+        if (worker->num_free > 0) {
+            worker->num_free--;
+        } else {
+            worker->next_unused++;
         }
+        world_retain(&worker->worlds, world_id);
         
-        players[num_players].id = num_players;
-        players[num_players].addr = addr;
-        players[num_players].current_building = physical_building;
-        players[num_players].current_room = buildings[physical_building][room_idx].id;
-        players[num_players].is_active = true;
-        
-        // Create MQTT topic for this player
-        sprintf(players[num_players].mqtt_topic, "%s%d", MQTT_TOPIC_PREFIX, num_players);
-        
-        syslog(LOG_INFO, "New player added with ID %d, starting in building %d (physical location %d), room %d", 
-               num_players, logical_building + 1, physical_building + 1, players[num_players].current_room);
+        if (idle_timeout > 0) {
+            timer_wheel_schedule(&worker->idle_timers, player_id, worker->now + idle_timeout);
+        }
         
-        // Send the player ID via UDP
-        char id_message[20];
-        sprintf(id_message, "player:%d", num_players);
-        send_udp_response(addr, id_message);
+        ASYNC_LOG(LOG_INFO, "New player added with ID %d on worker %d, starting in building %d (physical location %d), room %d", 
+               player->id, worker->index, logical_building + 1, physical_building + 1, worker->current_room[player_id]);
         
         // Send the initial room description via MQTT
-        send_room_description(num_players);
+        send_room_description(worker, player_id);
         
-        num_players++;
+        worker->num_players++;
+        metrics_count(&worker->metrics, COUNTER_JOINS);
+        return player_id;
+    } else {
+        ASYNC_LOG(LOG_WARNING, "Maximum number of players reached on worker %d, connection rejected", worker->index);
+        metrics_count(&worker->metrics, COUNTER_REJECTED_JOINS);
+        return -1;
+    }
+}
+
+/**
+ * End a player's session and return its slot to the free list
+ * The slot keeps its ID and MQTT topic for the next player who gets it
+ */
+void evict_player(Worker *worker, int player_id) {
+    Player *player = &worker->players[player_id];
+    
+    player_table_remove(&worker->player_table, &player->addr);
+    timer_wheel_cancel(&worker->idle_timers, player_id);
+    atomic_store_explicit(&player->reply_addr, 0, memory_order_release);
+    publisher_cancel(player->id);
+    player->outbox = NULL;
+    world_release(&worker->worlds, player->world);
+    player->is_active = false;
+    
+    worker->free_slots[worker->num_free++] = player_id;
+    worker->num_players--;
+    worker->evicted++;
+    metrics_count(&worker->metrics, COUNTER_EVICTIONS);
+    
+    ASYNC_LOG(LOG_INFO, "Player %d evicted after %u idle seconds on worker %d (%d active, %llu evicted)",
+           player->id, worker->now - player->last_active, worker->index,
+           worker->num_players, (unsigned long long)worker->evicted);
+}
+
+/**
+ * Idle deadline reached: evict the player, or push the deadline out if they were active since
+ */
+void idle_timer_expired(int player_id, void *ctx) {
+    Worker *worker = ctx;
+    uint32_t deadline = worker->players[player_id].last_active + idle_timeout;
+    
+    if ((int32_t)(deadline - worker->now) > 0) {
+        timer_wheel_schedule(&worker->idle_timers, player_id, deadline);
     } else {
-        syslog(LOG_WARNING, "Maximum number of players reached, connection rejected");
+        evict_player(worker, player_id);
+    }
+}
+
+/**
+ * Send a new game layout to a player and move them to a random start room
+ */
+void reset_player(Worker *worker, int player_id) {
+    Player *player = &worker->players[player_id];
+    
+    ASYNC_LOG(LOG_INFO, "Player %d requested game reset", player->id);
+    metrics_count(&worker->metrics, COUNTER_RESETS);
+    
+    // Move the player into a world of their own so the new layout changes nobody else's map
+    int world_id = world_make_private(&worker->worlds, player->world);
+    if (world_id < 0) {
+        ASYNC_LOG(LOG_ERR, "Error: No free world for player %d, reset ignored", player->id);
+        return;
+    }
+    player->world = world_id;
+    
+    // Randomize building order for a new game layout
+    randomize_building_order(worker, world_id);
+    
+    // Pick a random logical building
+    World *world = player_world(worker, player);
+    int logical_building = rng_below(&world->rng, worker->data->map.num_buildings);
+    
+    // Convert to physical building using the world's building order
+    int physical_building = world_physical(world, logical_building);
+    int start_room = worker->data->index.start_room[physical_building];
+    
+    if (start_room != 0) {
+        worker->current_building[player_id] = physical_building;
+        worker->current_room[player_id] = start_room;
+        
+        ASYNC_LOG(LOG_INFO, "Player %d reset to building %d (physical location %d), room %d", 
+               player->id, logical_building + 1, physical_building + 1, start_room);
+        
+        // Send updated room description
+        send_room_description(worker, player_id);
     }
 }
 
 /**
  * Process the received command
+ * buffer holds len bytes and is NUL-terminated
  */
-void process_command(char *buffer, struct sockaddr_in client_addr) {
+void process_command(Worker *worker, char *buffer, int len, struct sockaddr_in client_addr) {
+    // Binary frames are recognized by their first byte
+    if (len > 0 && (uint8_t)buffer[0] == MUD_FRAME_MAGIC) {
+        process_frames(worker, buffer, len, client_addr);
+        return;
+    }
+    metrics_count(&worker->metrics, COUNTER_TEXT_COMMANDS);
+    
     // Get player ID or add new player
-    int player_id = get_player_id(client_addr);
+    int player_id = get_player_id(worker, client_addr);
+    Player *player = player_id >= 0 ? &worker->players[player_id] : NULL;
+    
+    // A player over their command rate is ignored until the bucket refills
+    if (player && !take_command_token(worker, player)) {
+        return;
+    }
     
     // Check if this is a new player request
     if (strncmp(buffer, "new", 3) == 0) {
         if (player_id == -1) {
-            add_player(client_addr);
+            player_id = add_player(worker, client_addr);
+            if (player_id >= 0) {
+                // Send the player ID via UDP
+                send_player_id(worker, client_addr, &worker->players[player_id]);
+            }
         } else {
-            syslog(LOG_INFO, "Existing player %d requested new game", player_id);
+            ASYNC_LOG(LOG_INFO, "Existing player %d requested new game", player->id);
             // Just send the current room description again
-            send_room_description(player_id);
+            send_room_description(worker, player_id);
         }
         return;
     }
     
     // All other commands require an existing player
     if (player_id == -1) {
-        syslog(LOG_WARNING, "Command from unknown player: %s", buffer);
+        ASYNC_LOG(LOG_WARNING, "Command from unknown player: %s", buffer);
         return;
     }
     
     // Check for reset command
     if (strncmp(buffer, "reset", 5) == 0) {
-        syslog(LOG_INFO, "Player %d requested game reset", player_id);
+        submit_intent(worker, player_id, INTENT_RESET);
+        return;
+    }
+    
+    // Handle movement commands
+    if (strlen(buffer) > 0) {
+        int direction = direction_from_char(buffer[0]);
+        if (direction >= 0) {
+            submit_intent(worker, player_id, direction);
+        } else {
+            ASYNC_LOG(LOG_INFO, "Player %d sent invalid command: %s", player->id, buffer);
+            // Send error message via MQTT
+            metrics_count(&worker->metrics, COUNTER_INVALID_COMMANDS);
+            queue_message(worker, player_id, &invalid_command_payload, 0);
+        }
+    }
+}
+
+/**
+ * Send a binary JOIN_ACK carrying the player's token and ID
+ */
+void send_join_ack(Worker *worker, struct sockaddr_in addr, const Player *player) {
+    MudFrame ack = {
+        .magic = MUD_FRAME_MAGIC,
+        .version = MUD_PROTOCOL_VERSION,
+        .opcode = MUD_OP_JOIN_ACK,
+        .direction = 0,
+        .player_token = htonl(player->token),
+        .sequence = htonl((uint32_t)player->id),
+    };
+    udp_batch_queue(&worker->tx_batch, worker->sock_fd, &addr, (const char *)&ack, sizeof(ack));
+}
+
+/**
+ * Process a datagram of binary frames, applying them in order
+ */
+void process_frames(Worker *worker, const char *buffer, int len, struct sockaddr_in client_addr) {
+    if (len % sizeof(MudFrame) != 0 || len / sizeof(MudFrame) > MUD_MAX_FRAMES_PER_DATAGRAM) {
+        ASYNC_LOG(LOG_WARNING, "Malformed binary datagram of %d bytes", len);
+        metrics_count(&worker->metrics, COUNTER_INVALID_COMMANDS);
+        return;
+    }
+    metrics_add(&worker->metrics, COUNTER_BINARY_FRAMES, len / sizeof(MudFrame));
+    
+    int player_id = get_player_id(worker, client_addr);
+    
+    for (const char *p = buffer; p < buffer + len; p += sizeof(MudFrame)) {
+        MudFrame frame;
+        memcpy(&frame, p, sizeof(frame));
         
-        // Randomize building order for a new game layout
-        randomize_building_order();
+        if (frame.magic != MUD_FRAME_MAGIC || frame.version != MUD_PROTOCOL_VERSION) {
+            ASYNC_LOG(LOG_WARNING, "Unsupported binary frame version %d", frame.version);
+            return;
+        }
         
-        // Pick a random logical building
-        int logical_building = rand() % MAX_BUILDINGS;
+        if (frame.opcode == MUD_OP_JOIN) {
+            if (player_id == -1) {
+                player_id = add_player(worker, client_addr);
+            } else {
+                send_room_description(worker, player_id);
+            }
+            if (player_id >= 0) {
+                send_join_ack(worker, client_addr, &worker->players[player_id]);
+            }
+            continue;
+        }
         
-        // Convert to physical building using the building order
-        int physical_building = building_order[logical_building];
+        // All other frames require the session's token and a newer sequence number
+        if (player_id == -1) {
+            ASYNC_LOG(LOG_WARNING, "Binary frame from unknown player");
+            return;
+        }
         
-        int room_idx = -1;
+        Player *player = &worker->players[player_id];
+        uint32_t sequence = ntohl(frame.sequence);
         
-        // Find a start room in that building
-        for (int i = 0; i < MAX_ROOMS; i++) {
-            if (buildings[physical_building][i].is_start_room) {
-                room_idx = i;
-                break;
-            }
+        if (ntohl(frame.player_token) != player->token) {
+            ASYNC_LOG(LOG_WARNING, "Player %d sent a frame with a bad token", player->id);
+            return;
         }
-        
-        if (room_idx != -1) {
-            players[player_id].current_building = physical_building;
-            players[player_id].current_room = buildings[physical_building][room_idx].id;
-            
-            syslog(LOG_INFO, "Player %d reset to building %d (physical location %d), room %d", 
-                   player_id, logical_building + 1, physical_building + 1, players[player_id].current_room);
-            
-            // Send updated room description
-            send_room_description(player_id);
+        if ((int32_t)(sequence - player->last_sequence) <= 0) {
+            continue; // Duplicate or reordered frame
         }
-        return;
-    }
-    
-    // Handle movement commands
-    if (strlen(buffer) > 0) {
-        char direction = buffer[0];
-        switch (direction) {
-            case 'N':
-            case 'n':
-                handle_movement(player_id, 'n');
-                break;
-            case 'S':
-            case 's':
-                handle_movement(player_id, 's');
-                break;
-            case 'E':
-            case 'e':
-                handle_movement(player_id, 'e');
+        player->last_sequence = sequence;
+        if (!take_command_token(worker, player)) {
+            continue;
+        }
+        
+        switch (frame.opcode) {
+            case MUD_OP_MOVE:
+                if (frame.direction < NUM_DIRECTIONS) {
+                    submit_intent(worker, player_id, frame.direction);
+                } else {
+                    metrics_count(&worker->metrics, COUNTER_INVALID_COMMANDS);
+                    queue_message(worker, player_id, &invalid_command_payload, 0);
+                }
                 break;
-            case 'W':
-            case 'w':
-                handle_movement(player_id, 'w');
+            case MUD_OP_RESET:
+                submit_intent(worker, player_id, INTENT_RESET);
                 break;
             default:
-                syslog(LOG_INFO, "Player %d sent invalid command: %s", player_id, buffer);
-                // Send error message via MQTT
-                publish_mqtt_message(players[player_id].mqtt_topic, 
-                                   "Invalid command. Use N, S, E, W to move.");
+                ASYNC_LOG(LOG_INFO, "Player %d sent unknown opcode %d", player->id, frame.opcode);
+                break;
         }
     }
 }
 
+/**
+ * Apply a move or reset now, or with -T queue it for the next tick
+ */
+void submit_intent(Worker *worker, int player_id, int op) {
+    if (tick_ms == 0) {
+        if (op == INTENT_RESET) {
+            reset_player(worker, player_id);
+        } else {
+            handle_movement(worker, player_id, op);
+        }
+        return;
+    }
+    
+    if (worker->num_intents == worker->max_intents) {
+        metrics_count(&worker->metrics, COUNTER_DROPPED_INTENTS);
+        return;
+    }
+    worker->intents[worker->num_intents++] = (Intent){
+        .player_id = player_id,
+        .token = worker->players[player_id].token,
+        .op = op,
+    };
+}
+
 /**
  * Handle player movement
  */
-void handle_movement(int player_id, char direction) {
-    if (player_id < 0 || player_id >= num_players || !players[player_id].is_active) {
+void handle_movement(Worker *worker, int player_id, int direction) {
+    if (player_id < 0 || player_id >= worker->max_players || !worker->players[player_id].is_active) {
         return;
     }
     
-    int physical_building = players[player_id].current_building;
-    int current_room = players[player_id].current_room;
+    uint64_t start = metrics_now();
+    if (apply_move(worker, player_id, direction)) {
+        // Send the new room description
+        send_room_description(worker, player_id);
+    } else {
+        // No valid exit in that direction
+        queue_message(worker, player_id, &cant_go_payload, 0);
+    }
+    metrics_record(&worker->metrics, STAGE_MOVEMENT, metrics_now() - start);
+}
+
+/**
+ * Move a player one step; only the player's position changes
+ * Returns true if the player moved, false if there is no exit that way
+ */
+bool apply_move(Worker *worker, int player_id, int direction) {
+    Player *player = &worker->players[player_id];
+    const RoomMap *map = &worker->data->map;
+    const RoomIndex *index = &worker->data->index;
+    int physical_building = worker->current_building[player_id];
+    int current_room = worker->current_room[player_id];
     
-    // Get next room based on current room and direction using the building's logic
-    int next_room = get_next_room(current_room, direction);
+    // Get next room from this building's compiled transition table
+    int next_room = lookup_next_room(map, physical_building, current_room, direction);
     
     // Special case: -1 means transport to another building (connector room)
-    if (next_room == -1) {
-        // Find the room index
-        int room_idx = current_room - 1;  // Room IDs start at 1
+    if (next_room == CONNECTOR_EXIT) {
+        // Logical building this room connects to, or -1 if it isn't a working connector
+        int logical_next_building = index->connector_target[room_map_slot(map, physical_building, current_room)];
         
-        // Check if this is a connector room
-        if (room_idx >= 0 && room_idx < MAX_ROOMS && 
-            buildings[physical_building][room_idx].is_connector_room) {
+        if (logical_next_building >= 0) {
+            // Convert to physical building index using the player's world
+            int physical_next_building = world_physical(player_world(worker, player), logical_next_building);
             
-            // Get logical connected building ID (1-based)
-            int logical_next_building = buildings[physical_building][room_idx].connected_building_id - 1;
+            // Transport player to the new building's start room
+            worker->current_building[player_id] = physical_next_building;
+            worker->current_room[player_id] = room_index_entry(index, physical_next_building);
             
-            // Validate logical next building ID
-            if (logical_next_building >= 0 && logical_next_building < MAX_BUILDINGS) {
-                // Convert to physical building index using the building order
-                int physical_next_building = building_order[logical_next_building];
-                
-                // Find a start room in the next building
-                int start_room_idx = 0;
-                for (int i = 0; i < MAX_ROOMS; i++) {
-                    if (buildings[physical_next_building][i].is_start_room) {
-                        start_room_idx = i;
-                        break;
-                    }
-                }
-                
-                // Transport player to the new building's start room
-                players[player_id].current_building = physical_next_building;
-                players[player_id].current_room = buildings[physical_next_building][start_room_idx].id;
-                
-                syslog(LOG_INFO, "Player %d moved from building %d to building %d (physical position %d)", 
-                       player_id, physical_building + 1, logical_next_building + 1, physical_next_building + 1);
-                
-                // Send the new room description
-                send_room_description(player_id);
-                return;
-            }
+            ASYNC_LOG(LOG_INFO, "Player %d moved from building %d to building %d (physical position %d)", 
+                   player->id, physical_building + 1, logical_next_building + 1, physical_next_building + 1);
+            metrics_count(&worker->metrics, COUNTER_MOVES);
+            return true;
         }
     }
     
     // Normal movement within the same building
     if (next_room > 0) {
-        players[player_id].current_room = next_room;
-        
-        // Get description for the direction moved
-        const char* desc = get_room_description(buildings[physical_building], current_room, direction);
+        worker->current_room[player_id] = next_room;
         
         // Check if this is an item room (game win condition)
-        int next_room_idx = next_room - 1;
-        if (next_room_idx >= 0 && next_room_idx < MAX_ROOMS && 
-            buildings[physical_building][next_room_idx].is_item_room) {
+        if (next_room <= map->rooms_per_building &&
+            room_map_room(map, physical_building, next_room)->flags & ROOM_ITEM) {
             // Game won!
-            syslog(LOG_INFO, "Player %d found the item in building %d, room %d", 
-                   player_id, physical_building + 1, next_room);
+            ASYNC_LOG(LOG_INFO, "Player %d found the item in building %d, room %d", 
+                   player->id, physical_building + 1, next_room);
+        }
+        metrics_count(&worker->metrics, COUNTER_MOVES);
+        return true;
+    }
+    
+    metrics_count(&worker->metrics, COUNTER_BLOCKED_MOVES);
+    return false;
+}
+
+/**
+ * Simulation tick (-T): apply every queued intent in arrival order, then
+ * give each player it touched one message, for where they ended up, and
+ * hand them all to the publisher together
+ */
+void run_tick(Worker *worker) {
+    uint64_t start = metrics_now();
+    int num_touched = 0;
+    
+    for (int i = 0; i < worker->num_intents; i++) {
+        const Intent *intent = &worker->intents[i];
+        int player_id = intent->player_id;
+        const Player *player = &worker->players[player_id];
+        if (!player->is_active || player->token != intent->token) {
+            continue; // The session ended after queueing it
         }
         
-        // Send the new room description
-        send_room_description(player_id);
-    } else {
-        // No valid exit in that direction
-        char message[100];
-        sprintf(message, "You can't go that way. Try another direction.");
-        publish_mqtt_message(players[player_id].mqtt_topic, message);
+        if (worker->tick_result[player_id] == TICK_UNTOUCHED) {
+            worker->tick_players[num_touched++] = player_id;
+        }
+        if (intent->op == INTENT_RESET) {
+            reset_player(worker, player_id);
+            worker->tick_result[player_id] |= TICK_MOVED;
+        } else {
+            worker->tick_result[player_id] |= apply_move(worker, player_id, intent->op) ? TICK_MOVED : TICK_BLOCKED;
+        }
+    }
+    worker->num_intents = 0;
+    
+    for (int i = 0; i < num_touched; i++) {
+        int player_id = worker->tick_players[i];
+        // A player who moved at all sees the room they ended up in; the
+        // error for a later blocked move never replaces it in the outbox
+        if (worker->tick_result[player_id] & TICK_MOVED) {
+            send_room_description(worker, player_id);
+        }
+        if (worker->tick_result[player_id] & TICK_BLOCKED) {
+            queue_message(worker, player_id, &cant_go_payload, 0);
+        }
+        worker->tick_result[player_id] = TICK_UNTOUCHED;
     }
+    
+    flush_outbox(worker);
+    metrics_record(&worker->metrics, STAGE_TICK, metrics_now() - start);
 }
 
 /**
  * Send room description to player
  */
-void send_room_description(int player_id) {
-    if (player_id < 0 || player_id >= num_players || !players[player_id].is_active) {
+void send_room_description(Worker *worker, int player_id) {
+    if (player_id < 0 || player_id >= worker->max_players || !worker->players[player_id].is_active) {
         return;
     }
     
-    int physical_building = players[player_id].current_building;
-    int current_room = players[player_id].current_room;
-    int room_idx = current_room - 1;  // Room IDs start at 1
+    uint64_t start = metrics_now();
+    Player *player = &worker->players[player_id];
+    int physical_building = worker->current_building[player_id];
+    int current_room = worker->current_room[player_id];
     
-    if (room_idx < 0 || room_idx >= MAX_ROOMS) {
-        syslog(LOG_ERR, "Error: Invalid room index for player %d", player_id);
+    // Room IDs start at 1
+    if (current_room < 1 || current_room > worker->data->map.rooms_per_building) {
+        ASYNC_LOG(LOG_ERR, "Error: Invalid room index for player %d", player->id);
         return;
     }
     
-    // Find the logical building ID from the physical location (for display purposes)
-    int logical_building = -1;
-    for (int i = 0; i < MAX_BUILDINGS; i++) {
-        if (building_order[i] == physical_building) {
-            logical_building = i;
-            break;
+    // Logical building ID of the physical location in the player's world (for display purposes)
+    int logical_building = world_logical(player_world(worker, player), physical_building);
+    
+    // Room description message, formatted on the room's first visit
+    const Payload *payload = payload_cache_get(&worker->data->payloads, physical_building, current_room);
+    if (!payload) {
+        ASYNC_LOG(LOG_ERR, "Error: No room description for player %d", player->id);
+        return;
+    }
+    
+    // Queue for the player's MQTT topic; the publisher adds the header with
+    // the building number this player sees
+    queue_message(worker, player_id, payload, logical_building);
+    metrics_record(&worker->metrics, STAGE_FORMAT, metrics_now() - start);
+}
+
+/**
+ * Put a message in a player's outbox for the end of the batch. A newer
+ * room description replaces one already there, so a burst of moves in one
+ * batch publishes only the room the player ends up in. An error never
+ * replaces a room description, or the player would not see where they are.
+ */
+void queue_message(Worker *worker, int player_id, const Payload *payload, int logical_building) {
+    Player *player = &worker->players[player_id];
+    
+    if (player->outbox) {
+        metrics_count(&worker->metrics, COUNTER_COALESCED_MESSAGES);
+        if (payload->msg_class == PAYLOAD_ERROR && player->outbox->msg_class == PAYLOAD_ROOM) {
+            return;
+        }
+    } else {
+        worker->outbox_players[worker->num_outbox++] = player_id;
+    }
+    player->outbox = payload;
+    player->outbox_building = logical_building;
+}
+
+/**
+ * Hand every outbox message of the batch to the publisher
+ */
+void flush_outbox(Worker *worker) {
+    for (int i = 0; i < worker->num_outbox; i++) {
+        Player *player = &worker->players[worker->outbox_players[i]];
+        if (player->outbox) {
+            publisher_submit_room(player->id, player->outbox, player->outbox_building);
+            player->outbox = NULL;
         }
     }
+    worker->num_outbox = 0;
+}
+
+/**
+ * Charge a command to a player's token bucket of command_burst commands,
+ * refilled at command_rate per second. Kept as the time the bucket is next
+ * full (GCRA), so it is one timestamp per player and no refill loop.
+ * Returns false if the bucket is empty and the command should be dropped
+ */
+bool take_command_token(Worker *worker, Player *player) {
+    if (command_rate == 0) {
+        return true;
+    }
+    
+    uint64_t now = worker->batch_time;
+    uint64_t interval = 1000000000ULL / command_rate;
+    uint64_t full_at = player->next_command_at > now ? player->next_command_at : now;
+    if (full_at - now > (uint64_t)(command_burst - 1) * interval) {
+        metrics_count(&worker->metrics, COUNTER_RATE_LIMITED);
+        return false;
+    }
+    player->next_command_at = full_at + interval;
+    return true;
+}
+
+/**
+ * Get a player's MQTT topic by global player ID
+ */
+const char *player_topic(int player_id) {
+    return all_players[player_id].mqtt_topic;
+}
+
+/**
+ * Pack an IPv4 address and port into one word the control loop can read
+ * while the owning worker changes the player; never 0
+ */
+uint64_t pack_reply_addr(const struct sockaddr_in *addr) {
+    return UINT64_C(1) << 48 | (uint64_t)addr->sin_addr.s_addr << 16 | addr->sin_port;
+}
+
+/**
+ * Find where to send a player's messages directly: the player's address and
+ * the socket of the worker that owns them. Returns -1 if the player is inactive
+ * Runs on the control loop, so it only reads the player's reply_addr word
+ */
+int player_reply_to(int player_id, struct sockaddr_in *addr) {
+    uint64_t packed = atomic_load_explicit(&all_players[player_id].reply_addr, memory_order_acquire);
+    if (!packed) {
+        return -1;
+    }
+    
+    memset(addr, 0, sizeof(*addr));
+    addr->sin_family = AF_INET;
+    addr->sin_addr.s_addr = (uint32_t)(packed >> 16);
+    addr->sin_port = (uint16_t)packed;
+    
+    // Workers own contiguous ranges of IDs, see initialize_workers()
+    int per_worker = (max_players + num_workers - 1) / num_workers;
+    return workers[player_id / per_worker].sock_fd;
+}
+
+/**
+ * Publisher and logger figures for the stats endpoint, in Prometheus text format
+ */
+size_t format_server_metrics(char *buf, size_t cap) {
+    PublisherStats stats;
+    publisher_get_stats(&stats);
+    
+    int n = snprintf(buf, cap,
+        "# HELP mud_publish_submitted_total Messages handed to the publisher\n"
+        "# TYPE mud_publish_submitted_total counter\nmud_publish_submitted_total %llu\n"
+        "# HELP mud_publish_coalesced_total Messages replaced by a newer one before being sent\n"
+        "# TYPE mud_publish_coalesced_total counter\nmud_publish_coalesced_total %llu\n"
+        "# HELP mud_publish_sent_total Messages passed to the %s backend\n"
+        "# TYPE mud_publish_sent_total counter\nmud_publish_sent_total %llu\n"
+        "# HELP mud_publish_errors_total Backend publish failures\n"
+        "# TYPE mud_publish_errors_total counter\nmud_publish_errors_total %llu\n"
+        "# HELP mud_publish_queue_depth Players waiting to be published\n"
+        "# TYPE mud_publish_queue_depth gauge\nmud_publish_queue_depth %u\n"
+        "# HELP mud_publish_inflight Publishes not yet acknowledged\n"
+        "# TYPE mud_publish_inflight gauge\nmud_publish_inflight %u\n"
+        "# HELP mud_log_dropped_total Log messages dropped because the log ring was full\n"
+        "# TYPE mud_log_dropped_total counter\nmud_log_dropped_total %lu\n",
+        (unsigned long long)stats.submitted, (unsigned long long)stats.coalesced, backend->name,
+        (unsigned long long)stats.published, (unsigned long long)stats.errors,
+        stats.queue_depth, stats.inflight, async_log_dropped());
+    
+    if (n < 0) {
+        return 0;
+    }
+    return (size_t)n < cap ? (size_t)n : cap - 1;
+}
+
+/**
+ * Quiescent point between batches: the worker holds no pointers into the
+ * world here, so it reports the generation it has seen and picks up a
+ * reloaded world if there is one
+ */
+void worker_sync_world(Worker *worker) {
+    // Publish the generation before reading the pointer; finish_reload() does
+    // the opposite, so a worker can't miss a swap that it was counted past
+    uint64_t generation = atomic_load(&world_generation);
+    atomic_store(&worker->seen_generation, generation);
     
-    if (logical_building == -1) {
-        logical_building = physical_building; // Fallback
+    WorldData *data = atomic_load(&world_data);
+    if (data != worker->data) {
+        worker->data = data;
+        remap_players(worker);
     }
+}
+
+/**
+ * After a reload, move players whose room no longer exists to a start room
+ * Players whose (building, room) is still in the world stay where they are
+ */
+void remap_players(Worker *worker) {
+    const WorldData *data = worker->data;
+    int remapped = 0;
     
-    // Create room description message
-    char message[MAX_DESCRIPTION_LENGTH * 4 + 100];
-    sprintf(message, "Room %d (Building %d)\n\nN: %s\nS: %s\nE: %s\nW: %s", 
-            current_room, logical_building + 1,
-            buildings[physical_building][room_idx].north_desc,
-            buildings[physical_building][room_idx].south_desc,
-            buildings[physical_building][room_idx].east_desc,
-            buildings[physical_building][room_idx].west_desc);
+    for (int i = 0; i < worker->next_unused; i++) {
+        Player *player = &worker->players[i];
+        if (!player->is_active) {
+            continue;
+        }
+        if (worker->current_building[i] >= 0 && worker->current_building[i] < data->map.num_buildings &&
+            worker->current_room[i] >= 1 && worker->current_room[i] <= data->map.rooms_per_building) {
+            continue;
+        }
+        
+        int building = world_physical(player_world(worker, player), 0);
+        worker->current_building[i] = building;
+        worker->current_room[i] = room_index_entry(&data->index, building);
+        send_room_description(worker, i);
+        remapped++;
+    }
+    flush_outbox(worker);
     
-    // Publish to player's MQTT topic
-    publish_mqtt_message(players[player_id].mqtt_topic, message);
+    ASYNC_LOG(LOG_INFO, "Worker %d switched to world generation %llu, %d of %d players moved",
+              worker->index, (unsigned long long)data->generation, remapped, worker->num_players);
 }
 
 /**
- * Publish a message to an MQTT topic
+ * Drain the worker's socket: receive a batch, process it, send all replies
+ * at once; with -u the batch comes from the io_uring's completions and the
+ * replies go out in one submission
  */
-void publish_mqtt_message(const char *topic, const char *message) {
-    int rc = mosquitto_publish(mosq, NULL, topic, strlen(message), message, MQTT_QOS, false);
-    if (rc != MOSQ_ERR_SUCCESS) {
-        syslog(LOG_ERR, "Error publishing to MQTT topic %s: %s", topic, mosquitto_strerror(rc));
+void worker_receive(Worker *worker) {
+    for (;;) {
+        worker_sync_world(worker);
+        int count = worker->use_uring ? udp_uring_receive(&worker->uring, &worker->rx_batch)
+                                      : udp_batch_receive(&worker->rx_batch, worker->sock_fd);
+        if (count <= 0) {
+            if (worker->use_uring) {
+                udp_uring_release(&worker->uring);
+            }
+            break; // Nothing left (EAGAIN)
+        }
+        worker->batch_time = metrics_now();
+        
+        // Time each datagram spent queued in the kernel before we picked it up
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t picked_up = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        for (int i = 0; i < count; i++) {
+            uint64_t arrived = worker->rx_batch.rx_time[i];
+            if (arrived && arrived <= picked_up) {
+                metrics_record(&worker->metrics, STAGE_RECEIVE, picked_up - arrived);
+            }
+        }
+        metrics_add(&worker->metrics, COUNTER_DATAGRAMS, count);
+        
+        for (int i = 0; i < count; i++) {
+            char *buffer = udp_batch_data(&worker->rx_batch, i);
+            int len = worker->rx_batch.msgs[i].msg_len;
+            struct sockaddr_in client_addr = worker->rx_batch.addrs[i];
+            char addr_str[INET_ADDRSTRLEN];
+            
+            ASYNC_LOG(LOG_INFO, "Received command: %s from %s:%d", 
+                   (uint8_t)buffer[0] == MUD_FRAME_MAGIC ? "(binary)" : buffer,
+                   inet_ntop(AF_INET, &client_addr.sin_addr, addr_str, sizeof(addr_str)),
+                   ntohs(client_addr.sin_port));
+            
+            process_command(worker, buffer, len, client_addr);
+        }
+        
+        // One message per player for the whole batch
+        flush_outbox(worker);
+        
+        if (worker->use_uring) {
+            udp_uring_send(&worker->uring, &worker->tx_batch);
+            udp_uring_release(&worker->uring);
+        } else {
+            udp_batch_flush(&worker->tx_batch, worker->sock_fd);
+        }
+        
+        if (count < UDP_BATCH_SIZE) {
+            break; // The queue is drained; epoll will report the next arrival
+        }
     }
 }
 
 /**
- * MQTT logging callback
+ * Worker thread: sleep in epoll until datagrams, the idle sweep or shutdown
  */
-void mosquitto_log_callback(struct mosquitto *mosq, void *obj, int level, const char *str) {
-    switch (level) {
-        case MOSQ_LOG_ERR:
-            syslog(LOG_ERR, "MQTT Error: %s", str);
-            break;
-        case MOSQ_LOG_WARNING:
-            syslog(LOG_WARNING, "MQTT Warning: %s", str);
-            break;
-        case MOSQ_LOG_NOTICE:
-        case MOSQ_LOG_INFO:
-            syslog(LOG_INFO, "MQTT Info: %s", str);
-            break;
-        default:
-            syslog(LOG_DEBUG, "MQTT Debug: %s", str);
+void *worker_main(void *arg) {
+    Worker *worker = arg;
+    struct epoll_event events[4];
+    
+    start_worker_uring(worker);
+    for (;;) {
+        update_idle_timer(worker);
+        update_tick_timer(worker);
+        
+        // Blocked in epoll the worker uses no world data, so a reload needn't wait for it
+        atomic_store(&worker->seen_generation, WORKER_OFFLINE);
+        int n = epoll_wait(worker->epoll_fd, events, 4, -1);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            ASYNC_LOG(LOG_ERR, "Worker %d: epoll_wait failed", worker->index);
             break;
+        }
+        
+        worker->now = session_clock();
+        worker_sync_world(worker);
+        
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u32) {
+                case EVENT_SOCKET:
+                    worker_receive(worker);
+                    break;
+                case EVENT_TIMER: {
+                    uint64_t expirations;
+                    if (read(worker->timer_fd, &expirations, sizeof(expirations)) > 0) {
+                        // Evict sessions that have gone quiet
+                        timer_wheel_advance(&worker->idle_timers, worker->now, idle_timer_expired, worker);
+                    }
+                    break;
+                }
+                case EVENT_SIM_TICK: {
+                    uint64_t expirations;
+                    if (read(worker->tick_fd, &expirations, sizeof(expirations)) > 0) {
+                        run_tick(worker);
+                    }
+                    break;
+                }
+                case EVENT_WAKE:
+                    return NULL; // Shutdown
+            }
+        }
     }
+    
+    return NULL;
 }
 
 /**
- * Signal handler
+ * Main thread's event loop: signals, the publish queue, the backend's
+ * socket (MQTT), the stats endpoint and a one-second housekeeping tick.
+ * Returns once SIGINT or SIGTERM arrives
  */
-void signal_handler(int sig) {
-    switch (sig) {
-        case SIGINT:
-        case SIGTERM:
-            syslog(LOG_INFO, "Received signal %d, shutting down...", sig);
-            running = false;
-            break;
-        default:
+void control_loop(sigset_t *signals) {
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    int signal_fd = signalfd(-1, signals, SFD_NONBLOCK | SFD_CLOEXEC);
+    int tick_fd = backend->tick ? timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC) : -1;
+    int metrics_fd = metrics_port > 0 ? metrics_server_start(metrics_port, format_server_metrics) : -1;
+    int retire_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    reload_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (epoll_fd < 0 || signal_fd < 0 || retire_fd < 0 || reload_fd < 0) {
+        syslog(LOG_ERR, "Error creating control loop descriptors");
+        running = false;
+    }
+    if (metrics_port > 0 && metrics_fd < 0) {
+        syslog(LOG_WARNING, "Could not start metrics endpoint on port %d", metrics_port);
+    }
+    
+    struct { int fd; uint32_t tag; } sources[] = {
+        { signal_fd, EVENT_SIGNAL },
+        { publisher_fd(), EVENT_PUBLISHER },
+        { metrics_fd, EVENT_METRICS },
+        { tick_fd, EVENT_TICK },
+        { reload_fd, EVENT_RELOAD },
+        { retire_fd, EVENT_RETIRE },
+    };
+    for (size_t i = 0; running && i < sizeof(sources) / sizeof(sources[0]); i++) {
+        if (sources[i].fd >= 0) {
+            struct epoll_event ev = { .events = EPOLLIN, .data.u32 = sources[i].tag };
+            epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sources[i].fd, &ev);
+        }
+    }
+    if (tick_fd >= 0) {
+        struct itimerspec spec = { .it_interval = { 1, 0 }, .it_value = { 1, 0 } };
+        timerfd_settime(tick_fd, 0, &spec, NULL);
+    }
+    
+    int backend_fd = -1;          // The backend socket currently registered
+    uint32_t backend_events = 0;
+    bool more = false;            // Publisher has messages it can send right away
+    uint64_t drain_deadline = 0;  // Set once shutdown starts
+    bool retire_armed = false;    // retire_fd is running
+    
+    for (;;) {
+        // Follow the backend's socket across reconnects, and ask for
+        // writability only while it has data queued
+        if (backend->socket_fd) {
+            int fd = backend->socket_fd();
+            uint32_t wanted = EPOLLIN | (backend->want_write() ? EPOLLOUT : 0);
+            if (fd != backend_fd) {
+                if (backend_fd >= 0) {
+                    epoll_ctl(epoll_fd, EPOLL_CTL_DEL, backend_fd, NULL);
+                }
+                if (fd >= 0) {
+                    struct epoll_event ev = { .events = wanted, .data.u32 = EVENT_BACKEND };
+                    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev);
+                }
+                backend_fd = fd;
+                backend_events = wanted;
+            } else if (fd >= 0 && wanted != backend_events) {
+                struct epoll_event ev = { .events = wanted, .data.u32 = EVENT_BACKEND };
+                epoll_ctl(epoll_fd, EPOLL_CTL_MOD, fd, &ev);
+                backend_events = wanted;
+            }
+        }
+        
+        if (!running) {
+            // Shutting down: workers have stopped; leave once everything queued is out
+            bool backend_busy = backend->want_write && backend_fd >= 0 && backend->want_write();
+            if ((!publisher_pending() && !backend_busy) || metrics_now() > drain_deadline) {
+                break;
+            }
+        }
+        
+        struct epoll_event events[8];
+        int n = epoll_wait(epoll_fd, events, 8, more ? 0 : (running ? -1 : 100));
+        if (n < 0 && errno != EINTR) {
+            syslog(LOG_ERR, "Control loop: epoll_wait failed");
             break;
+        }
+        
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u32) {
+                case EVENT_SIGNAL: {
+                    struct signalfd_siginfo info;
+                    if (read(signal_fd, &info, sizeof(info)) != sizeof(info) || !running) {
+                        break;
+                    }
+                    if (info.ssi_signo == SIGHUP) {
+                        start_reload();
+                    } else {
+                        syslog(LOG_INFO, "Received signal %d, shutting down...", (int)info.ssi_signo);
+                        running = false;
+                        
+                        // Stop the workers so no new messages arrive, then drain
+                        for (int w = 0; w < num_workers; w++) {
+                            uint64_t one = 1;
+                            if (write(workers[w].wake_fd, &one, sizeof(one)) < 0) {
+                                syslog(LOG_ERR, "Could not wake worker %d", w);
+                            }
+                        }
+                        for (int w = 0; w < num_workers; w++) {
+                            pthread_join(workers[w].thread, NULL);
+                        }
+                        drain_deadline = metrics_now() + SHUTDOWN_DRAIN_MS * 1000000ULL;
+                    }
+                    break;
+                }
+                case EVENT_BACKEND:
+                    backend->handle_io(events[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP),
+                                       events[i].events & EPOLLOUT);
+                    break;
+                case EVENT_METRICS:
+                    metrics_server_handle();
+                    break;
+                case EVENT_TICK: {
+                    uint64_t expirations;
+                    if (read(tick_fd, &expirations, sizeof(expirations)) > 0) {
+                        backend->tick();
+                    }
+                    break;
+                }
+                case EVENT_RELOAD: {
+                    uint64_t count;
+                    if (read(reload_fd, &count, sizeof(count)) > 0 && running) {
+                        finish_reload();
+                    }
+                    break;
+                }
+                case EVENT_RETIRE: {
+                    uint64_t expirations;
+                    if (read(retire_fd, &expirations, sizeof(expirations)) > 0) {
+                        retire_worlds();
+                    }
+                    break;
+                }
+                case EVENT_PUBLISHER:
+                    break; // publisher_run() below consumes the wakeup
+            }
+        }
+        
+        more = publisher_run(PUBLISH_BUDGET);
+        if (grace_worlds || retired_worlds) {
+            retire_worlds();
+        }
+        
+        // Check on replaced worlds every RETIRE_POLL_MS while any are waiting,
+        // since an idle server may have no other event to wake it
+        bool want_retire = running && (grace_worlds || retired_worlds);
+        if (want_retire != retire_armed) {
+            struct itimerspec spec = { 0 };
+            if (want_retire) {
+                spec.it_interval.tv_nsec = RETIRE_POLL_MS * 1000000L;
+                spec.it_value = spec.it_interval;
+            }
+            timerfd_settime(retire_fd, 0, &spec, NULL);
+            retire_armed = want_retire;
+        }
+        
+        // Push out what was just published without waiting for another poll
+        if (backend->want_write && backend_fd >= 0 && backend->want_write()) {
+            backend->handle_io(false, true);
+        }
+    }
+    
+    metrics_server_stop();
+    if (reload_running) {
+        pthread_join(reload_thread, NULL);
+        reload_running = false;
+        if (reloaded_world) {
+            free_world_data(reloaded_world);
+            reloaded_world = NULL;
+        }
     }
+    if (reload_fd >= 0) {
+        close(reload_fd);
+        reload_fd = -1;
+    }
+    if (retire_fd >= 0) {
+        close(retire_fd);
+    }
+    if (tick_fd >= 0) {
+        close(tick_fd);
+    }
+    if (signal_fd >= 0) {
+        close(signal_fd);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+}
+
+/**
+ * Set up every worker's shard of players, socket and lobby world
+ */
+int initialize_workers() {
+    workers = calloc(num_workers, sizeof(Worker));
+    all_players = calloc(max_players, sizeof(Player));
+    if (!workers || !all_players) {
+        syslog(LOG_ERR, "Error: Out of memory allocating %d players", max_players);
+        return -1;
+    }
+    
+    // Split the players evenly; each worker's IDs are a contiguous range
+    int per_worker = (max_players + num_workers - 1) / num_workers;
+    // A slot's ID and MQTT topic never change; sessions that reuse the slot share them
+    for (int i = 0; i < max_players; i++) {
+        all_players[i].id = i;
+        sprintf(all_players[i].mqtt_topic, "%s%d", MQTT_TOPIC_PREFIX, i);
+    }
+    for (int w = 0; w < num_workers; w++) {
+        workers[w].sock_fd = -1;
+        workers[w].epoll_fd = -1;
+        workers[w].timer_fd = -1;
+        workers[w].tick_fd = -1;
+        workers[w].wake_fd = -1;
+        atomic_init(&workers[w].seen_generation, WORKER_OFFLINE);
+    }
+    
+    for (int w = 0; w < num_workers; w++) {
+        Worker *worker = &workers[w];
+        int first = w * per_worker;
+        
+        worker->index = w;
+        worker->players = &all_players[first < max_players ? first : max_players];
+        worker->max_players = first + per_worker <= max_players ? per_worker
+                            : (first < max_players ? max_players - first : 0);
+        
+        worker->now = session_clock();
+        worker->free_slots = malloc((worker->max_players ? worker->max_players : 1) * sizeof(int));
+        size_t slots = worker->max_players ? worker->max_players : 1;
+        worker->outbox_players = malloc(slots * sizeof(int));
+        worker->current_building = calloc(slots, sizeof(int));
+        worker->current_room = calloc(slots, sizeof(int));
+        worker->max_intents = tick_ms > 0 ? slots * TICK_INTENTS_PER_PLAYER : 0;
+        worker->intents = tick_ms > 0 ? malloc(worker->max_intents * sizeof(Intent)) : NULL;
+        worker->tick_result = tick_ms > 0 ? calloc(slots, sizeof(uint8_t)) : NULL;
+        worker->tick_players = tick_ms > 0 ? malloc(slots * sizeof(int)) : NULL;
+        if (!worker->free_slots || !worker->outbox_players ||
+            !worker->current_building || !worker->current_room ||
+            (tick_ms > 0 && (!worker->intents || !worker->tick_result || !worker->tick_players)) ||
+            player_table_init(&worker->player_table, worker->max_players) != 0 ||
+            timer_wheel_init(&worker->idle_timers, worker->max_players, worker->now) != 0 ||
+            world_pool_init(&worker->worlds, worker->max_players + 1, atomic_load(&world_data)->map.num_buildings,
+                            rng_derive(world_seed, 2 * w + 1)) != 0) {
+            syslog(LOG_ERR, "Error: Out of memory allocating player table for worker %d", w);
+            return -1;
+        }
+        
+        if (initialize_socket(worker) != 0 || initialize_worker_events(worker) != 0) {
+            return -1;
+        }
+        
+        udp_batch_init(&worker->rx_batch);
+        udp_batch_init(&worker->tx_batch);
+        if (metrics_register(&worker->metrics) != 0) {
+            syslog(LOG_ERR, "Error: No room in the metrics registry for worker %d", w);
+            return -1;
+        }
+        worker->data = atomic_load(&world_data);
+        rng_seed(&worker->rng, rng_derive(world_seed, 2 * w));
+        
+        // Players share the lobby world until they reset; one world per player plus
+        // the lobby means the pool never runs out
+        worker->lobby_world = world_create(&worker->worlds);
+        randomize_building_order(worker, worker->lobby_world);
+    }
+    
+    syslog(LOG_INFO, "%d workers sharing %d players", num_workers, max_players);
+    return 0;
+}
+
+/**
+ * Close every worker socket and free the shards
+ */
+void cleanup_workers() {
+    if (workers) {
+        for (int w = 0; w < num_workers; w++) {
+            int fds[] = { workers[w].sock_fd, workers[w].epoll_fd, workers[w].timer_fd, workers[w].tick_fd,
+                          workers[w].wake_fd };
+            for (size_t i = 0; i < sizeof(fds) / sizeof(fds[0]); i++) {
+                if (fds[i] >= 0) {
+                    close(fds[i]);
+                }
+            }
+            if (workers[w].player_table.slots) {
+                player_table_free(&workers[w].player_table);
+            }
+            timer_wheel_free(&workers[w].idle_timers);
+            free(workers[w].free_slots);
+            free(workers[w].outbox_players);
+            free(workers[w].current_building);
+            free(workers[w].current_room);
+            free(workers[w].intents);
+            free(workers[w].tick_result);
+            free(workers[w].tick_players);
+            world_pool_free(&workers[w].worlds);
+            if (workers[w].use_uring) {
+                udp_uring_free(&workers[w].uring);
+            }
+        }
+    }
+    free(workers);
+    free(all_players);
 }
 
 /**
@@ -509,61 +1774,225 @@ int main(int argc, char *argv[]) {
     openlog("mud_server", LOG_PID | LOG_CONS, LOG_DAEMON);
     syslog(LOG_INFO, "MUD Server starting...");
     
-    // Seed random number generator
-    srand(time(NULL));
+    // Parse command line options
+    int opt;
+    while ((opt = getopt(argc, argv, "m:w:l:s:q:e:i:t:b:M:S:W:G:ur:B:T:")) != -1) {
+        switch (opt) {
+            case 'm':
+                max_players = atoi(optarg);
+                break;
+            case 'w':
+                num_workers = atoi(optarg);
+                break;
+            case 'l':
+                async_log_max_level = atoi(optarg);
+                break;
+            case 's':
+                async_log_set_sampling(LOG_INFO, atoi(optarg));
+                async_log_set_sampling(LOG_DEBUG, atoi(optarg));
+                break;
+            case 'q':
+                room_qos = atoi(optarg);
+                break;
+            case 'e':
+                error_qos = atoi(optarg);
+                break;
+            case 'i':
+                max_inflight = atoi(optarg);
+                break;
+            case 't':
+                idle_timeout = atoi(optarg);
+                break;
+            case 'M':
+                metrics_port = atoi(optarg);
+                break;
+            case 'S':
+                world_seed = strtoull(optarg, NULL, 0);
+                world_seed_set = true;
+                break;
+            case 'W':
+                world_path = optarg;
+                break;
+            case 'G':
+                if (world_gen_parse_shape(optarg, &generate_buildings, &generate_rooms) != 0) {
+                    fprintf(stderr, "Bad world shape %s (use BUILDINGSxROOMS, at most %d buildings and %d rooms)\n",
+                            optarg, WORLD_MAX_BUILDINGS, WORLD_MAX_ROOMS);
+                    closelog();
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 'u':
+                uring_mode = true;
+                break;
+            case 'r':
+                command_rate = atoi(optarg);
+                break;
+            case 'B':
+                command_burst = atoi(optarg);
+                break;
+            case 'T':
+                tick_ms = atoi(optarg);
+                break;
+            case 'b':
+                backend = publish_backend_find(optarg);
+                if (!backend) {
+                    fprintf(stderr, "Unknown publish backend %s (use mqtt, udp or memory)\n", optarg);
+                    closelog();
+                    return EXIT_FAILURE;
+                }
+                break;
+            default:
+                fprintf(stderr, "Usage: %s [-m max_players] [-w workers] [-l log_level] [-s info_sample_rate]\n"
+                        "       [-q room_qos] [-e error_qos] [-i max_inflight] [-t idle_timeout]\n"
+                        "       [-b mqtt|udp|memory] [-M metrics_port] [-S seed] [-W world_image | -G BUILDINGSxROOMS] [-u]\n"
+                        "       [-r command_rate] [-B command_burst] [-T tick_ms]\n", argv[0]);
+                closelog();
+                return EXIT_FAILURE;
+        }
+    }
     
-    // Set up signal handlers
-    signal(SIGINT, signal_handler);
-    signal(SIGTERM, signal_handler);
+    long num_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_cpus < 1) {
+        num_cpus = 1;
+    }
+    if (num_workers == 0) {
+        num_workers = num_cpus; // One worker per core
+        if (num_workers > MAX_WORKERS) {
+            syslog(LOG_WARNING, "%d cores, using %d workers", num_workers, MAX_WORKERS);
+            num_workers = MAX_WORKERS;
+        }
+    }
+    
+    if (max_players <= 0 || num_workers < 0 || num_workers > MAX_WORKERS || max_inflight <= 0 || idle_timeout < 0 ||
+        metrics_port < 0 || metrics_port > 65535 ||
+        command_rate < 0 || command_rate > 1000000 || command_burst < 1 || tick_ms < 0 ||
+        room_qos < 0 || room_qos > 2 || error_qos < 0 || error_qos > 2 ||
+        (world_path && generate_buildings)) {
+        syslog(LOG_ERR, "Error: invalid option value");
+        closelog();
+        return EXIT_FAILURE;
+    }
+    
+    // Block shutdown and reload signals in every thread (so before any thread starts);
+    // the control loop reads them from a signalfd
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    
+    // Move logging off the packet path
+    if (async_log_start() != 0) {
+        syslog(LOG_WARNING, "Could not start log thread, logging synchronously");
+    }
+    
+    // Seed every world's generator from one 64-bit seed; log it so a game can be replayed
+    if (!world_seed_set) {
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        uint64_t entropy = ((uint64_t)ts.tv_sec << 32) ^ (uint64_t)ts.tv_nsec ^ ((uint64_t)getpid() << 16);
+        world_seed = splitmix64(&entropy);
+    }
+    syslog(LOG_INFO, "World seed 0x%016llx (replay with -S 0x%016llx)",
+           (unsigned long long)world_seed, (unsigned long long)world_seed);
     
     // Initialize rooms
-    initialize_buildings();
+    WorldData *data = load_world_data();
+    if (!data) {
+        syslog(LOG_ERR, "Failed to initialize buildings. Exiting.");
+        async_log_stop();
+        closelog();
+        return EXIT_FAILURE;
+    }
+    atomic_store(&world_data, data);
     
-    // Initialize MQTT
-    if (initialize_mqtt() != 0) {
-        syslog(LOG_ERR, "Failed to initialize MQTT. Exiting.");
+    // Connect the publish backend (the MQTT broker by default)
+    if (!backend) {
+        backend = publish_backend_find(DEFAULT_BACKEND);
+    }
+    static const PublishTarget target = { player_topic, player_reply_to };
+    if (backend->open(&target, max_inflight) != 0) {
+        syslog(LOG_ERR, "Failed to initialize %s publish backend. Exiting.", backend->name);
+        async_log_stop();
         closelog();
         return EXIT_FAILURE;
     }
     
-    // Initialize socket
-    if (initialize_socket() != 0) {
+    // Initialize worker shards and sockets
+    if (initialize_workers() != 0) {
         syslog(LOG_ERR, "Failed to initialize socket. Exiting.");
-        mosquitto_destroy(mosq);
-        mosquitto_lib_cleanup();
+        cleanup_workers();
+        backend->close();
+        async_log_stop();
         closelog();
         return EXIT_FAILURE;
     }
     
-    syslog(LOG_INFO, "MUD Server running on UDP port %d", UDP_PORT);
+    // Start the publisher stage between the workers and the backend
+    if (publisher_start(backend, max_players, room_qos, error_qos, max_inflight) != 0) {
+        syslog(LOG_ERR, "Failed to start publisher. Exiting.");
+        cleanup_workers();
+        backend->close();
+        async_log_stop();
+        closelog();
+        return EXIT_FAILURE;
+    }
     
-    // Main loop
-    char buffer[MAX_BUFFER_SIZE];
-    struct sockaddr_in client_addr;
-    socklen_t addr_len = sizeof(client_addr);
+    syslog(LOG_INFO, "MUD Server running on UDP port %d, publishing via %s", UDP_PORT, backend->name);
     
-    while (running) {
-        int recv_len = recvfrom(sock_fd, buffer, MAX_BUFFER_SIZE - 1, 0, 
-                              (struct sockaddr *)&client_addr, &addr_len);
+    // Start one thread per worker, each pinned to its own core
+    for (int w = 0; w < num_workers; w++) {
+        if (pthread_create(&workers[w].thread, NULL, worker_main, &workers[w]) != 0) {
+            syslog(LOG_ERR, "Error starting worker %d", w);
+            num_workers = w;
+            running = false;
+            break;
+        }
         
-        if (recv_len > 0) {
-            buffer[recv_len] = '\0';
-            syslog(LOG_INFO, "Received command: %s from %s:%d", 
-                   buffer, inet_ntoa(client_addr.sin_addr), ntohs(client_addr.sin_port));
-            
-            process_command(buffer, client_addr);
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(w % num_cpus, &cpus);
+        pthread_setaffinity_np(workers[w].thread, sizeof(cpus), &cpus);
+    }
+    
+    if (running) {
+        // Publish, serve stats and keep the broker connection alive until
+        // SIGINT or SIGTERM; the loop stops the workers on its way out
+        control_loop(&signals);
+    } else {
+        for (int w = 0; w < num_workers; w++) {
+            uint64_t one = 1;
+            if (write(workers[w].wake_fd, &one, sizeof(one)) == sizeof(one)) {
+                pthread_join(workers[w].thread, NULL);
+            }
         }
     }
     
-    // Cleanup
-    close(sock_fd);
+    for (int w = 0; w < num_workers; w++) {
+        syslog(LOG_INFO, "Worker %d: %d active sessions in %d worlds, %llu evicted", w,
+               workers[w].num_players, workers[w].worlds.in_use, (unsigned long long)workers[w].evicted);
+    }
     
-    mosquitto_disconnect(mosq);
-    mosquitto_loop_stop(mosq, true);
-    mosquitto_destroy(mosq);
-    mosquitto_lib_cleanup();
+    // Report publisher backpressure
+    publisher_stop();
+    
+    PublisherStats stats;
+    publisher_get_stats(&stats);
+    syslog(LOG_INFO, "Publisher: %llu submitted, %llu coalesced, %llu published, %llu errors, "
+           "queue high water %u, %llu inflight waits",
+           (unsigned long long)stats.submitted, (unsigned long long)stats.coalesced,
+           (unsigned long long)stats.published, (unsigned long long)stats.errors,
+           stats.queue_high_water, (unsigned long long)stats.inflight_waits);
+    
+    // Cleanup
+    backend->close();
+    cleanup_workers();
+    free_retired_worlds(true);
+    free_world_data(atomic_load(&world_data));
     
     syslog(LOG_INFO, "MUD Server shutting down");
+    async_log_stop();
     closelog();
     
     return EXIT_SUCCESS;
@@ -0,0 +1,193 @@
+/**
+ * payload_cache.c - Prebuilt room description messages
+ *
+ * Each message is formatted into its own allocation the first time a
+ * room is entered and published into the room's entry with one
+ * compare-and-swap; when two workers format the same room at once, the
+ * loser frees its copy and uses the winner's. Entries never change once
+ * set, so worker threads share the cache without locking, and it never
+ * needs rebuilding when a building order changes because the building
+ * number is only added by payload_header(). The entry array is zeroed
+ * memory, which the kernel maps on first touch for a large world, so an
+ * untouched part of the world costs next to nothing.
+ */
+
+#include <stdatomic.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "payload_cache.h"
+
+// Copy a string literal to p and advance past it
+#define APPEND_LITERAL(p, str) (memcpy(p, str, sizeof(str) - 1), (p) + sizeof(str) - 1)
+
+// Descriptions are shorter than MAX_DESCRIPTION_LENGTH in every world that
+// loads, so any room's message fits behind its header
+#define PAYLOAD_LABELS_LENGTH (sizeof("\n\nN: \nS: \nE: \nW: ") - 1)
+_Static_assert(NUM_DIRECTIONS * (MAX_DESCRIPTION_LENGTH - 1) + PAYLOAD_LABELS_LENGTH + PAYLOAD_HEADER_MAX_LENGTH
+               < PAYLOAD_MAX_LENGTH, "Room messages must fit in PAYLOAD_MAX_LENGTH");
+
+typedef struct CachedPayload {
+    Payload payload;
+    struct CachedPayload *next; // Next formatted message, for payload_cache_free()
+    char text[];
+} CachedPayload;
+
+struct PayloadTable {
+    CachedPayload *_Atomic built;     // Every formatted message
+    atomic_size_t built_count;
+    atomic_size_t size;               // Bytes of formatted messages
+    CachedPayload *_Atomic entries[]; // Indexed like the world's RoomMap; NULL until formatted
+};
+
+/**
+ * Format the part of a room's message after the header
+ * Each description is cut at its recorded length, which loading has
+ * bounded, so the message fits even if an image's text runs on past it
+ */
+static int format_payload(char *buf, size_t size, const RoomRecord *room, const StringArena *strings) {
+    return snprintf(buf, size, "\n\nN: %.*s\nS: %.*s\nE: %.*s\nW: %.*s",
+                    (int)room->desc_len[DIR_NORTH], room_record_desc(room, strings, DIR_NORTH),
+                    (int)room->desc_len[DIR_SOUTH], room_record_desc(room, strings, DIR_SOUTH),
+                    (int)room->desc_len[DIR_EAST], room_record_desc(room, strings, DIR_EAST),
+                    (int)room->desc_len[DIR_WEST], room_record_desc(room, strings, DIR_WEST));
+}
+
+/**
+ * Set up an empty cache for a world; messages are formatted as rooms are entered
+ * Returns 0 on success, -1 if out of memory
+ */
+int payload_cache_init(PayloadCache *cache, const RoomMap *map, const StringArena *strings) {
+    size_t count = room_map_size(map);
+    size_t table_size = sizeof(PayloadTable) + count * sizeof(CachedPayload *);
+    PayloadTable *table = calloc(1, table_size);
+    if (!table) {
+        syslog(LOG_ERR, "Error: Out of memory for the room payload cache");
+        return -1;
+    }
+
+    cache->table = table;
+    cache->map = map;
+    cache->strings = strings;
+    cache->count = count;
+    syslog(LOG_INFO, "Room payload cache ready: %zu rooms, %zu bytes of entries; messages are formatted on first visit",
+           count, table_size);
+    return 0;
+}
+
+/**
+ * Release the cache and every message formatted into it
+ */
+void payload_cache_free(PayloadCache *cache) {
+    PayloadTable *table = cache->table;
+    if (!table) {
+        return;
+    }
+    syslog(LOG_INFO, "Room payload cache released: %zu of %zu messages formatted, %zu bytes",
+           atomic_load(&table->built_count), cache->count, atomic_load(&table->size));
+
+    CachedPayload *cached = atomic_load(&table->built);
+    while (cached) {
+        CachedPayload *next = cached->next;
+        free(cached);
+        cached = next;
+    }
+    free(table);
+    cache->table = NULL;
+    cache->count = 0;
+}
+
+/**
+ * Format a room's message and publish it into its entry
+ * Returns the entry's message, or NULL if out of memory
+ */
+static CachedPayload *format_entry(const PayloadCache *cache, size_t slot) {
+    PayloadTable *table = cache->table;
+    const RoomRecord *room = &cache->map->rooms[slot];
+    char text[PAYLOAD_MAX_LENGTH];
+    int len = format_payload(text, sizeof(text), room, cache->strings);
+
+    CachedPayload *cached = malloc(sizeof(CachedPayload) + len + 1);
+    if (!cached) {
+        return NULL;
+    }
+    memcpy(cached->text, text, len + 1);
+    cached->payload.data = cached->text;
+    cached->payload.len = len;
+    cached->payload.msg_class = PAYLOAD_ROOM;
+    cached->payload.room_id = room->id;
+
+    CachedPayload *expected = NULL;
+    if (!atomic_compare_exchange_strong_explicit(&table->entries[slot], &expected, cached,
+                                                 memory_order_acq_rel, memory_order_acquire)) {
+        free(cached); // Another worker formatted it first
+        return expected;
+    }
+
+    cached->next = atomic_load_explicit(&table->built, memory_order_relaxed);
+    while (!atomic_compare_exchange_weak_explicit(&table->built, &cached->next, cached,
+                                                  memory_order_release, memory_order_relaxed)) {
+    }
+    atomic_fetch_add_explicit(&table->built_count, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&table->size, sizeof(CachedPayload) + len + 1, memory_order_relaxed);
+    return cached;
+}
+
+/**
+ * Get the message for a room, formatting it on the room's first visit;
+ * room IDs start at 1
+ * Returns NULL if any index is out of range or out of memory
+ */
+const Payload *payload_cache_get(const PayloadCache *cache, int physical_building, int room_id) {
+    const RoomMap *map = cache->map;
+    if (!cache->table || physical_building < 0 || room_id < 1 || room_id > map->rooms_per_building) {
+        return NULL;
+    }
+
+    size_t slot = (size_t)physical_building * map->rooms_per_building + room_id - 1;
+    if (slot >= cache->count) {
+        return NULL;
+    }
+    CachedPayload *cached = atomic_load_explicit(&cache->table->entries[slot], memory_order_acquire);
+    if (!cached) {
+        cached = format_entry(cache, slot);
+    }
+    return cached ? &cached->payload : NULL;
+}
+
+/**
+ * Append a number's decimal digits
+ * Returns the position after the last digit
+ */
+char *payload_append_number(char *p, uint32_t n) {
+    char digits[10];
+    int len = 0;
+    do {
+        digits[len++] = '0' + n % 10;
+        n /= 10;
+    } while (n);
+    while (len > 0) {
+        *p++ = digits[--len];
+    }
+    return p;
+}
+
+/**
+ * Write the header a payload is sent behind, as a player with the given
+ * building numbering sees it, into buf (PAYLOAD_HEADER_MAX_LENGTH bytes)
+ * Returns the header's length, 0 if the payload goes out without one
+ */
+size_t payload_header(const Payload *payload, int logical_building, char *buf) {
+    if (payload->room_id == 0) {
+        return 0;
+    }
+
+    char *p = buf;
+    p = APPEND_LITERAL(p, "Room ");
+    p = payload_append_number(p, payload->room_id);
+    p = APPEND_LITERAL(p, " (Building ");
+    p = payload_append_number(p, logical_building + 1);
+    p = APPEND_LITERAL(p, ")");
+    return p - buf;
+}
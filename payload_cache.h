@@ -0,0 +1,61 @@
+/**
+ * payload_cache.h - Prebuilt room description messages
+ *
+ * The message a player receives on entering a room is a short header,
+ * "Room <id> (Building <n>)", where n is the logical number the player's
+ * building order gives the building, followed by the room's four
+ * descriptions. The descriptions are formatted once per room, the first
+ * time any player enters it, so loading a world formats nothing and the
+ * cache only holds text for rooms that have been visited; after that,
+ * moving into the room never formats text. The publisher writes the header
+ * when it sends the message, and backends send it and the cached text as
+ * separate pieces of one message. Keeping the header out of the cache
+ * makes it grow with the number of rooms, not rooms times buildings
+ * squared. Each loaded world has its own cache, so a reload can start the
+ * next one while workers keep reading the current one.
+ */
+#ifndef PAYLOAD_CACHE_H
+#define PAYLOAD_CACHE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "rooms.h"
+
+// Message classes, so each can be published with its own QoS
+#define PAYLOAD_ROOM 0      // Room descriptions
+#define PAYLOAD_ERROR 1     // "You can't go that way" and other errors
+#define PAYLOAD_CLASSES 2
+
+// Longest message with its header: four descriptions of under
+// MAX_DESCRIPTION_LENGTH each, plus labels
+#define PAYLOAD_MAX_LENGTH 2048
+
+// Longest header payload_header() writes: "Room <id> (Building <n>)"
+#define PAYLOAD_HEADER_MAX_LENGTH 48
+
+typedef struct {
+    const char *data;   // NUL-terminated message; for a room, the text after its header
+    size_t len;         // strlen(data)
+    int msg_class;      // PAYLOAD_ROOM or PAYLOAD_ERROR
+    uint32_t room_id;   // Room the header names, or 0 if the message has no header
+} Payload;
+
+// Build a Payload from a string literal
+#define PAYLOAD_LITERAL(str, cls) { str, sizeof(str) - 1, cls, 0 }
+
+typedef struct PayloadTable PayloadTable;
+
+typedef struct {
+    PayloadTable *table;          // Entries and formatted messages, filled in by payload_cache_get()
+    const RoomMap *map;           // The world the messages are formatted from
+    const StringArena *strings;
+    size_t count;                 // Entries, one per room
+} PayloadCache;
+
+// Function prototypes
+int payload_cache_init(PayloadCache *cache, const RoomMap *map, const StringArena *strings);
+void payload_cache_free(PayloadCache *cache);
+const Payload *payload_cache_get(const PayloadCache *cache, int physical_building, int room_id);
+char *payload_append_number(char *p, uint32_t n);
+size_t payload_header(const Payload *payload, int logical_building, char *buf);
+
+#endif /* PAYLOAD_CACHE_H */
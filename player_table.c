@@ -0,0 +1,203 @@
+/**
+ * player_table.c - Hash index of player sessions
+ *
+ * Linear-probing hash table sized to at most half full, so a lookup
+ * usually touches a single cache line. Removed entries leave tombstones
+ * that keep probe chains intact; the table is rehashed in place once
+ * tombstones make up too much of it.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "player_table.h"
+
+/**
+ * Pack an address into a table key
+ */
+static inline uint64_t player_key(const struct sockaddr_in *addr) {
+    return ((uint64_t)addr->sin_addr.s_addr << 16) | addr->sin_port;
+}
+
+/**
+ * Fibonacci hashing: take the top bits of key * 2^64/phi
+ */
+static inline size_t player_hash(const PlayerTable *table, uint64_t key) {
+    return (size_t)((key * 0x9E3779B97F4A7C15ULL) >> table->shift);
+}
+
+/**
+ * Allocate a table that can hold max_entries players
+ * Returns 0 on success, -1 if out of memory
+ */
+int player_table_init(PlayerTable *table, size_t max_entries) {
+    size_t capacity = 16;
+    unsigned bits = 4;
+
+    // Keep the load factor at or below 0.5
+    while (capacity < max_entries * 2) {
+        capacity <<= 1;
+        bits++;
+    }
+
+    table->slots = malloc(capacity * sizeof(PlayerTableSlot));
+    if (!table->slots) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < capacity; i++) {
+        table->slots[i].key = 0;
+        table->slots[i].player_id = PLAYER_SLOT_EMPTY;
+    }
+
+    table->capacity = capacity;
+    table->shift = 64 - bits;
+    table->count = 0;
+    table->tombstones = 0;
+    return 0;
+}
+
+/**
+ * Release the table's memory
+ */
+void player_table_free(PlayerTable *table) {
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->tombstones = 0;
+}
+
+/**
+ * Find the player ID for an address
+ * Returns -1 if the address has no session
+ */
+int player_table_lookup(const PlayerTable *table, const struct sockaddr_in *addr) {
+    uint64_t key = player_key(addr);
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = player_hash(table, key), probes = 0; probes < table->capacity;
+         i = (i + 1) & mask, probes++) {
+        const PlayerTableSlot *slot = &table->slots[i];
+
+        if (slot->player_id == PLAYER_SLOT_EMPTY) {
+            return -1;
+        }
+        if (slot->player_id >= 0 && slot->key == key) {
+            return slot->player_id;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Rehash every live entry in place, dropping all tombstones
+ */
+static void player_table_rehash(PlayerTable *table) {
+    size_t mask = table->capacity - 1;
+    PlayerTableSlot *old = malloc(table->count * sizeof(PlayerTableSlot));
+    size_t n = 0;
+
+    if (!old) {
+        return; // Keep the tombstones; lookups stay correct, just longer
+    }
+
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].player_id >= 0) {
+            old[n++] = table->slots[i];
+        }
+        table->slots[i].player_id = PLAYER_SLOT_EMPTY;
+    }
+
+    for (size_t j = 0; j < n; j++) {
+        size_t i = player_hash(table, old[j].key);
+        while (table->slots[i].player_id != PLAYER_SLOT_EMPTY) {
+            i = (i + 1) & mask;
+        }
+        table->slots[i] = old[j];
+    }
+
+    table->tombstones = 0;
+    free(old);
+}
+
+/**
+ * Map an address to a player ID
+ * Returns 0 on success, -1 if the address is already present or the table is full
+ */
+int player_table_insert(PlayerTable *table, const struct sockaddr_in *addr, int player_id) {
+    uint64_t key = player_key(addr);
+    size_t mask = table->capacity - 1;
+    size_t target = table->capacity;
+
+    if (player_id < 0 || table->count + 1 > table->capacity / 2) {
+        return -1;
+    }
+
+    for (size_t i = player_hash(table, key), probes = 0; probes < table->capacity;
+         i = (i + 1) & mask, probes++) {
+        PlayerTableSlot *slot = &table->slots[i];
+
+        if (slot->player_id == PLAYER_SLOT_EMPTY) {
+            if (target == table->capacity) {
+                target = i;
+            }
+            break;
+        }
+        if (slot->player_id == PLAYER_SLOT_TOMBSTONE) {
+            // Reuse the first tombstone, but keep probing for a duplicate
+            if (target == table->capacity) {
+                target = i;
+            }
+        } else if (slot->key == key) {
+            return -1;
+        }
+    }
+
+    if (target == table->capacity) {
+        return -1;
+    }
+
+    if (table->slots[target].player_id == PLAYER_SLOT_TOMBSTONE) {
+        table->tombstones--;
+    }
+    table->slots[target].key = key;
+    table->slots[target].player_id = player_id;
+    table->count++;
+    return 0;
+}
+
+/**
+ * Remove an address from the table
+ * Returns the removed player ID, or -1 if the address was not present
+ */
+int player_table_remove(PlayerTable *table, const struct sockaddr_in *addr) {
+    uint64_t key = player_key(addr);
+    size_t mask = table->capacity - 1;
+
+    for (size_t i = player_hash(table, key), probes = 0; probes < table->capacity;
+         i = (i + 1) & mask, probes++) {
+        PlayerTableSlot *slot = &table->slots[i];
+
+        if (slot->player_id == PLAYER_SLOT_EMPTY) {
+            return -1;
+        }
+        if (slot->player_id >= 0 && slot->key == key) {
+            int player_id = slot->player_id;
+
+            // A slot followed by an empty one can't be in any probe chain
+            if (table->slots[(i + 1) & mask].player_id == PLAYER_SLOT_EMPTY) {
+                slot->player_id = PLAYER_SLOT_EMPTY;
+            } else {
+                slot->player_id = PLAYER_SLOT_TOMBSTONE;
+                table->tombstones++;
+            }
+            table->count--;
+
+            if (table->tombstones > table->capacity / 4) {
+                player_table_rehash(table);
+            }
+            return player_id;
+        }
+    }
+    return -1;
+}
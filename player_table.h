@@ -0,0 +1,37 @@
+/**
+ * player_table.h - Hash index of player sessions
+ *
+ * Open-addressing hash table keyed on the client's (IPv4 address, port)
+ * that maps a UDP source address to an index in the players[] array.
+ */
+#ifndef PLAYER_TABLE_H
+#define PLAYER_TABLE_H
+#include <stddef.h>
+#include <stdint.h>
+#include <netinet/in.h>
+
+// Slot markers; any value >= 0 is a player ID
+#define PLAYER_SLOT_EMPTY -1
+#define PLAYER_SLOT_TOMBSTONE -2
+
+typedef struct {
+    uint64_t key;       // (address << 16) | port, both in network byte order
+    int32_t player_id;  // player ID, PLAYER_SLOT_EMPTY or PLAYER_SLOT_TOMBSTONE
+} PlayerTableSlot;
+
+typedef struct {
+    PlayerTableSlot *slots;
+    size_t capacity;    // always a power of two
+    unsigned shift;     // 64 - log2(capacity), for multiplicative hashing
+    size_t count;       // live entries
+    size_t tombstones;  // removed entries still occupying a slot
+} PlayerTable;
+
+// Function prototypes
+int player_table_init(PlayerTable *table, size_t max_entries);
+void player_table_free(PlayerTable *table);
+int player_table_lookup(const PlayerTable *table, const struct sockaddr_in *addr);
+int player_table_insert(PlayerTable *table, const struct sockaddr_in *addr, int player_id);
+int player_table_remove(PlayerTable *table, const struct sockaddr_in *addr);
+
+#endif /* PLAYER_TABLE_H */
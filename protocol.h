@@ -0,0 +1,34 @@
+/**
+ * protocol.h - Binary command protocol
+ *
+ * Besides the text commands ("new", "reset", "N"/"S"/"E"/"W"), the server
+ * accepts datagrams made of one or more fixed-size MudFrames. The first
+ * byte of a frame is MUD_FRAME_MAGIC, which is not printable ASCII, so the
+ * two forms can never be confused. Multi-byte fields are big-endian.
+ */
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+#include <stdint.h>
+
+#define MUD_FRAME_MAGIC 0xD5
+#define MUD_PROTOCOL_VERSION 1
+#define MUD_MAX_FRAMES_PER_DATAGRAM 64
+
+// Opcodes
+#define MUD_OP_JOIN 0x01      // Same as "new"; token and sequence are ignored
+#define MUD_OP_MOVE 0x02      // direction is a Direction (DIR_NORTH..DIR_WEST)
+#define MUD_OP_RESET 0x03     // Same as "reset"
+#define MUD_OP_JOIN_ACK 0x81  // Server reply to JOIN: token, sequence = player ID
+
+typedef struct __attribute__((packed)) {
+    uint8_t magic;          // MUD_FRAME_MAGIC
+    uint8_t version;        // MUD_PROTOCOL_VERSION
+    uint8_t opcode;         // MUD_OP_*
+    uint8_t direction;      // For MUD_OP_MOVE
+    uint32_t player_token;  // Issued in the JOIN_ACK; must match on MOVE and RESET
+    uint32_t sequence;      // Increases with every frame; stale frames are dropped
+} MudFrame;
+
+_Static_assert(sizeof(MudFrame) == 12, "MudFrame must stay 12 bytes on the wire");
+
+#endif /* PROTOCOL_H */
@@ -0,0 +1,119 @@
+/**
+ * publish_backend.c - UDP and in-memory publish backends
+ *
+ * The MQTT backend lives in publish_mqtt.c so that it is the only file
+ * that needs libmosquitto.
+ */
+
+#include <stdatomic.h>
+#include <string.h>
+#include <syslog.h>
+#include <sys/socket.h>
+#include "publish_backend.h"
+#include "async_log.h"
+
+static const PublishTarget *udp_target;
+
+/**
+ * UDP backend: nothing to connect
+ */
+static int udp_open(const PublishTarget *target, int max_inflight) {
+    udp_target = target;
+    return 0;
+}
+
+/**
+ * UDP backend: send the message as one datagram from the socket that owns
+ * the player, the header and the cached payload gathered by the kernel
+ */
+static int udp_publish(int player_id, const char *header, size_t header_len, const Payload *payload, int qos) {
+    struct sockaddr_in addr;
+    int sock_fd = udp_target->reply_to(player_id, &addr);
+    if (sock_fd < 0) {
+        return 0; // Session ended since the message was queued
+    }
+
+    struct iovec iov[2] = {
+        { .iov_base = (void *)header, .iov_len = header_len },
+        { .iov_base = (void *)payload->data, .iov_len = payload->len },
+    };
+    struct msghdr msg = {
+        .msg_name = &addr,
+        .msg_namelen = sizeof(addr),
+        .msg_iov = header_len > 0 ? iov : iov + 1,
+        .msg_iovlen = header_len > 0 ? 2 : 1,
+    };
+    if (sendmsg(sock_fd, &msg, 0) < 0) {
+        ASYNC_LOG(LOG_ERR, "Error sending message to player %d over UDP", player_id);
+        return -1;
+    }
+    return 0;
+}
+
+static void udp_close(void) {
+    udp_target = NULL;
+}
+
+const PublishBackend udp_backend = {
+    .name = "udp",
+    .async_acks = false,
+    .open = udp_open,
+    .publish = udp_publish,
+    .close = udp_close,
+};
+
+static atomic_uint_fast64_t memory_messages[PAYLOAD_CLASSES];
+static atomic_uint_fast64_t memory_bytes;
+
+/**
+ * Memory backend: reset the counters
+ */
+static int memory_open(const PublishTarget *target, int max_inflight) {
+    for (int i = 0; i < PAYLOAD_CLASSES; i++) {
+        atomic_store(&memory_messages[i], 0);
+    }
+    atomic_store(&memory_bytes, 0);
+    return 0;
+}
+
+/**
+ * Memory backend: count the message and drop it
+ */
+static int memory_publish(int player_id, const char *header, size_t header_len, const Payload *payload, int qos) {
+    atomic_fetch_add_explicit(&memory_messages[payload->msg_class], 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&memory_bytes, header_len + payload->len, memory_order_relaxed);
+    return 0;
+}
+
+/**
+ * Memory backend: report what would have been sent
+ */
+static void memory_close(void) {
+    syslog(LOG_INFO, "Memory sink: %llu room messages, %llu error messages, %llu bytes",
+           (unsigned long long)atomic_load(&memory_messages[PAYLOAD_ROOM]),
+           (unsigned long long)atomic_load(&memory_messages[PAYLOAD_ERROR]),
+           (unsigned long long)atomic_load(&memory_bytes));
+}
+
+const PublishBackend memory_backend = {
+    .name = "memory",
+    .async_acks = false,
+    .open = memory_open,
+    .publish = memory_publish,
+    .close = memory_close,
+};
+
+/**
+ * Look up a backend by name
+ * Returns NULL if there is no such backend
+ */
+const PublishBackend *publish_backend_find(const char *name) {
+    static const PublishBackend *const backends[] = { &mqtt_backend, &udp_backend, &memory_backend };
+
+    for (size_t i = 0; i < sizeof(backends) / sizeof(backends[0]); i++) {
+        if (strcmp(backends[i]->name, name) == 0) {
+            return backends[i];
+        }
+    }
+    return NULL;
+}
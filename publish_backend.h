@@ -0,0 +1,49 @@
+/**
+ * publish_backend.h - Destinations for published messages
+ *
+ * The publisher thread hands every message to one backend, chosen at
+ * startup: the MQTT broker, a UDP datagram straight back to the player's
+ * controller, or an in-memory sink that only counts (for profiling the
+ * game loop without any network output).
+ *
+ * Backends run on the control loop thread, so they need no locking.
+ * A message arrives as a header written for the player (possibly empty)
+ * and the cached payload that follows it; a backend that can send the two
+ * as separate pieces never copies the payload.
+ */
+#ifndef PUBLISH_BACKEND_H
+#define PUBLISH_BACKEND_H
+#include <stdbool.h>
+#include <netinet/in.h>
+#include "payload_cache.h"
+
+// What a backend needs to know about players
+typedef struct {
+    const char *(*topic_of)(int player_id);
+    int (*reply_to)(int player_id, struct sockaddr_in *addr); // Socket to reply from, or -1 if inactive
+} PublishTarget;
+
+typedef struct {
+    const char *name;
+    bool async_acks;   // Completions arrive later through publisher_acked()
+    int (*open)(const PublishTarget *target, int max_inflight);
+    int (*publish)(int player_id, const char *header, size_t header_len,
+                   const Payload *payload, int qos);  // 0 on success, -1 on error
+    void (*close)(void);
+
+    // Optional (NULL if the backend has no connection): the control loop
+    // watches socket_fd() and calls handle_io() when it is ready
+    int (*socket_fd)(void);                          // -1 while disconnected
+    bool (*want_write)(void);
+    void (*handle_io)(bool readable, bool writable);
+    void (*tick)(void);                              // Once a second: keepalives, reconnects
+} PublishBackend;
+
+extern const PublishBackend mqtt_backend;
+extern const PublishBackend udp_backend;
+extern const PublishBackend memory_backend;
+
+// Function prototypes
+const PublishBackend *publish_backend_find(const char *name);
+
+#endif /* PUBLISH_BACKEND_H */
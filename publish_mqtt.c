@@ -0,0 +1,208 @@
+/**
+ * publish_mqtt.c - MQTT publish backend
+ *
+ * Publishes each message to the player's topic on the local broker.
+ * There is no libmosquitto network thread: the control loop watches the
+ * client's socket and calls mqtt_handle_io() and mqtt_tick(). Each
+ * completed publish is reported through on_publish(), which frees a slot
+ * in the publisher's inflight window. Building with -DMUD_NO_MQTT leaves this backend out,
+ * so the server builds and runs without libmosquitto.
+ */
+
+#include <string.h>
+#include <syslog.h>
+#include "publish_backend.h"
+#include "publisher.h"
+#include "async_log.h"
+
+#ifndef MUD_NO_MQTT
+#include <mosquitto.h>
+
+// MQTT Configuration
+#define MQTT_HOST "localhost"
+#define MQTT_PORT 1883
+#define MQTT_KEEPALIVE 60
+
+static struct mosquitto *mosq = NULL;
+static const PublishTarget *mqtt_target;
+static bool connected = false;
+static char message_buf[PAYLOAD_MAX_LENGTH]; // A header and payload put together for mosquitto_publish()
+
+/**
+ * MQTT logging callback
+ */
+static void mosquitto_log_callback(struct mosquitto *m, void *obj, int level, const char *str) {
+    switch (level) {
+        case MOSQ_LOG_ERR:
+            ASYNC_LOG(LOG_ERR, "MQTT Error: %s", str);
+            break;
+        case MOSQ_LOG_WARNING:
+            ASYNC_LOG(LOG_WARNING, "MQTT Warning: %s", str);
+            break;
+        case MOSQ_LOG_NOTICE:
+        case MOSQ_LOG_INFO:
+            ASYNC_LOG(LOG_INFO, "MQTT Info: %s", str);
+            break;
+        default:
+            ASYNC_LOG(LOG_DEBUG, "MQTT Debug: %s", str);
+            break;
+    }
+}
+
+/**
+ * mosquitto calls this once a message is written (QoS 0) or acknowledged (QoS 1+)
+ */
+static void on_publish(struct mosquitto *m, void *obj, int mid) {
+    publisher_acked();
+}
+
+/**
+ * Initialize the MQTT client and connect to the broker
+ */
+static int mqtt_open(const PublishTarget *target, int max_inflight) {
+    mqtt_target = target;
+    mosquitto_lib_init();
+    mosq = mosquitto_new(NULL, true, NULL);
+    if (!mosq) {
+        syslog(LOG_ERR, "Error: Out of memory when creating MQTT client");
+        mosquitto_lib_cleanup();
+        return -1;
+    }
+
+    mosquitto_log_callback_set(mosq, mosquitto_log_callback);
+    mosquitto_publish_callback_set(mosq, on_publish);
+    mosquitto_max_inflight_messages_set(mosq, max_inflight);
+
+    int rc = mosquitto_connect(mosq, MQTT_HOST, MQTT_PORT, MQTT_KEEPALIVE);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        syslog(LOG_ERR, "Error: Could not connect to MQTT broker: %s", mosquitto_strerror(rc));
+        mosquitto_destroy(mosq);
+        mosquitto_lib_cleanup();
+        return -1;
+    }
+
+    connected = true;
+    return 0;
+}
+
+/**
+ * The client's socket, for the control loop to watch
+ */
+static int mqtt_socket_fd(void) {
+    return mosquitto_socket(mosq);
+}
+
+/**
+ * True if libmosquitto has packets queued for the broker
+ */
+static bool mqtt_want_write(void) {
+    return mosquitto_want_write(mosq);
+}
+
+/**
+ * Note a lost connection; mqtt_tick() reconnects
+ */
+static void mqtt_check(int rc, const char *what) {
+    if (rc != MOSQ_ERR_SUCCESS && connected) {
+        ASYNC_LOG(LOG_WARNING, "MQTT %s failed: %s", what, mosquitto_strerror(rc));
+        connected = false;
+    }
+}
+
+/**
+ * Read acknowledgements and write queued publishes
+ */
+static void mqtt_handle_io(bool readable, bool writable) {
+    if (readable) {
+        mqtt_check(mosquitto_loop_read(mosq, 1), "read");
+    }
+    if (writable && connected) {
+        mqtt_check(mosquitto_loop_write(mosq, 1), "write");
+    }
+}
+
+/**
+ * Keepalive pings and retries, and reconnecting after a lost connection
+ */
+static void mqtt_tick(void) {
+    if (!connected) {
+        int rc = mosquitto_reconnect(mosq);
+        if (rc != MOSQ_ERR_SUCCESS) {
+            ASYNC_LOG(LOG_WARNING, "Could not reconnect to MQTT broker: %s", mosquitto_strerror(rc));
+            return;
+        }
+        ASYNC_LOG(LOG_INFO, "Reconnected to MQTT broker");
+        connected = true;
+    }
+    mqtt_check(mosquitto_loop_misc(mosq), "keepalive");
+}
+
+/**
+ * Publish a message to the player's topic. MQTT takes one buffer, so a
+ * message with a header is put together first; libmosquitto copies it.
+ */
+static int mqtt_publish(int player_id, const char *header, size_t header_len, const Payload *payload, int qos) {
+    const char *data = payload->data;
+    size_t len = payload->len;
+    if (header_len > 0) {
+        memcpy(message_buf, header, header_len);
+        memcpy(message_buf + header_len, payload->data, payload->len);
+        data = message_buf;
+        len += header_len;
+    }
+
+    int rc = mosquitto_publish(mosq, NULL, mqtt_target->topic_of(player_id), len, data, qos, false);
+    if (rc != MOSQ_ERR_SUCCESS) {
+        ASYNC_LOG(LOG_ERR, "Error publishing to MQTT topic %s: %s",
+                  mqtt_target->topic_of(player_id), mosquitto_strerror(rc));
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Disconnect from the broker and release the client
+ */
+static void mqtt_close(void) {
+    mosquitto_disconnect(mosq);
+    mosquitto_loop_write(mosq, 1); // Flush the DISCONNECT
+    mosquitto_destroy(mosq);
+    mosquitto_lib_cleanup();
+    mosq = NULL;
+}
+
+#else
+
+/**
+ * Built without libmosquitto: refuse to start
+ */
+static int mqtt_open(const PublishTarget *target, int max_inflight) {
+    syslog(LOG_ERR, "Error: Built without MQTT support; choose another backend with -b");
+    return -1;
+}
+
+static int mqtt_publish(int player_id, const char *header, size_t header_len, const Payload *payload, int qos) {
+    return -1;
+}
+
+static void mqtt_close(void) {
+}
+
+#define mqtt_socket_fd NULL
+#define mqtt_want_write NULL
+#define mqtt_handle_io NULL
+#define mqtt_tick NULL
+
+#endif /* MUD_NO_MQTT */
+
+const PublishBackend mqtt_backend = {
+    .name = "mqtt",
+    .async_acks = true,
+    .open = mqtt_open,
+    .publish = mqtt_publish,
+    .close = mqtt_close,
+    .socket_fd = mqtt_socket_fd,
+    .want_write = mqtt_want_write,
+    .handle_io = mqtt_handle_io,
+    .tick = mqtt_tick,
+};
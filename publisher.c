@@ -0,0 +1,380 @@
+/**
+ * publisher.c - Pipelined publisher
+ *
+ * mailbox[player] holds the newest unsent Payload for that player, with
+ * the logical building number a room description's header shows. A
+ * worker swaps its message in; if the mailbox was empty it also pushes
+ * the player ID onto the ready queue. A mailbox is only emptied by the
+ * control loop, after popping the ID, so a player is queued at most once
+ * and the queue never needs more than max_players slots. The control
+ * loop runs publisher_run(), which pops players, swaps each mailbox back
+ * to empty and publishes whatever it found.
+ *
+ * An error never replaces an unsent room description: the player would
+ * be left not knowing which room they are in. A cancelled message stays
+ * in its mailbox as MAILBOX_CANCELLED until the control loop pops it.
+ *
+ * The ready queue uses the same sequence-numbered ring as async_log.c.
+ * Workers signal an eventfd when they queue a player into an idle
+ * publisher, so the control loop sleeps in epoll until there is work.
+ * For backends that complete asynchronously (MQTT), the publisher stops
+ * taking new messages while max_inflight publishes are unacknowledged;
+ * meanwhile workers keep running and newer messages coalesce in the
+ * mailboxes.
+ *
+ * A mailbox entry is one 64-bit word so it can be swapped atomically: the
+ * Payload pointer in the low MAILBOX_BUILDING_SHIFT bits (user-space
+ * addresses on x86-64 and arm64 fit in 47 or 48), the building number
+ * above it and MAILBOX_ERROR in the top bit, so a worker can tell an error
+ * from a room description without following a pointer the control loop
+ * may be done with.
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/eventfd.h>
+#include "publisher.h"
+#include "async_log.h"
+#include "metrics.h"
+
+typedef struct {
+    atomic_size_t sequence;
+    int player_id;
+} ReadySlot;
+
+static const PublishBackend *backend;
+static int qos[PAYLOAD_CLASSES];
+static int max_inflight;
+
+#define MAILBOX_BUILDING_SHIFT 48
+#define MAILBOX_PAYLOAD_MASK ((UINT64_C(1) << MAILBOX_BUILDING_SHIFT) - 1)
+#define MAILBOX_BUILDING_MASK ((UINT64_C(1) << 63) - 1)
+#define MAILBOX_ERROR (UINT64_C(1) << 63)   // The payload is PAYLOAD_ERROR
+#define MAILBOX_CANCELLED UINT64_C(1)       // Session ended; never a Payload address
+_Static_assert(sizeof(uintptr_t) == sizeof(uint64_t), "Mailbox entries pack a pointer into 64 bits");
+_Static_assert(WORLD_MAX_BUILDINGS <= (1 << (63 - MAILBOX_BUILDING_SHIFT)), "Building numbers must fit above the pointer");
+
+static _Atomic uint64_t *mailbox;       // 0 when empty
+static _Atomic uint64_t *submitted_at;  // metrics_now() of each mailbox's newest message
+static Metrics metrics;                 // Publish latency, written by the control loop
+static ReadySlot *ready;
+static char header_buf[PAYLOAD_HEADER_MAX_LENGTH]; // Header of the message being published (control loop only)
+static size_t ready_mask;
+static _Alignas(64) atomic_size_t enqueue_pos;
+static _Alignas(64) atomic_size_t dequeue_pos; // Written by the control loop only
+
+static int wake_fd = -1;              // eventfd the control loop watches
+static atomic_bool wake_pending;      // wake_fd has been signalled and not yet consumed
+static bool started = false;
+
+static atomic_uint_fast64_t submitted, coalesced, published, errors, acked, inflight_waits;
+static atomic_uint inflight;
+static atomic_uint queue_high_water;
+
+/**
+ * Push a player onto the ready queue
+ * Returns false if the queue is full (can't happen while IDs are < max_players)
+ */
+static bool ready_push(int player_id) {
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    ReadySlot *slot;
+
+    for (;;) {
+        slot = &ready[pos & ready_mask];
+        size_t seq = atomic_load_explicit(&slot->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                break;
+            }
+        } else if (diff < 0) {
+            return false;
+        } else {
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+        }
+    }
+
+    slot->player_id = player_id;
+    atomic_store_explicit(&slot->sequence, pos + 1, memory_order_release);
+
+    unsigned depth = (unsigned)(pos + 1 - atomic_load_explicit(&dequeue_pos, memory_order_relaxed));
+    unsigned high = atomic_load_explicit(&queue_high_water, memory_order_relaxed);
+    while (depth > high &&
+           !atomic_compare_exchange_weak_explicit(&queue_high_water, &high, depth,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+    return true;
+}
+
+/**
+ * Pop the next ready player (publisher thread only)
+ * Returns -1 if the queue is empty
+ */
+static int ready_pop(void) {
+    size_t pos = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+    ReadySlot *slot = &ready[pos & ready_mask];
+
+    if (atomic_load_explicit(&slot->sequence, memory_order_acquire) != pos + 1) {
+        return -1;
+    }
+
+    int player_id = slot->player_id;
+    atomic_store_explicit(&slot->sequence, pos + ready_mask + 1, memory_order_release);
+    atomic_store_explicit(&dequeue_pos, pos + 1, memory_order_relaxed);
+    return player_id;
+}
+
+/**
+ * True if the ready queue has nothing for the publisher
+ */
+static bool ready_empty(void) {
+    size_t pos = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+    return atomic_load_explicit(&ready[pos & ready_mask].sequence, memory_order_acquire) != pos + 1;
+}
+
+/**
+ * Signal the control loop, once per batch of submissions
+ */
+static void wake_publisher(void) {
+    if (!atomic_exchange(&wake_pending, true)) {
+        uint64_t one = 1;
+        if (write(wake_fd, &one, sizeof(one)) < 0) {
+            atomic_store(&wake_pending, false);
+        }
+    }
+}
+
+/**
+ * Called by an asynchronous backend when a publish completes
+ */
+void publisher_acked(void) {
+    atomic_fetch_add_explicit(&acked, 1, memory_order_relaxed);
+    atomic_fetch_sub_explicit(&inflight, 1, memory_order_acq_rel);
+}
+
+/**
+ * True if any player is still queued for publishing
+ */
+bool publisher_pending(void) {
+    return !ready_empty();
+}
+
+/**
+ * Position of the newest entry in the ready queue
+ * Once publisher_queue_passed() returns true for it, every message queued
+ * before the mark has been published or replaced; the payloads they
+ * pointed to are no longer referenced
+ */
+size_t publisher_queue_mark(void) {
+    return atomic_load_explicit(&enqueue_pos, memory_order_acquire);
+}
+
+/**
+ * True once the publisher has taken every ready queue entry before mark
+ */
+bool publisher_queue_passed(size_t mark) {
+    return (intptr_t)(atomic_load_explicit(&dequeue_pos, memory_order_acquire) - mark) >= 0;
+}
+
+/**
+ * File descriptor that becomes readable when messages are waiting
+ */
+int publisher_fd(void) {
+    return wake_fd;
+}
+
+/**
+ * Publish up to budget ready messages (control loop only)
+ * Returns true if messages are still waiting and can be sent right away
+ */
+bool publisher_run(int budget) {
+    // Consume the wakeup before draining, so a submit racing with the drain signals again
+    uint64_t count;
+    if (read(wake_fd, &count, sizeof(count)) == sizeof(count)) {
+        atomic_store(&wake_pending, false);
+    }
+
+    for (int sent = 0; sent < budget; sent++) {
+        // Hold off while the broker is behind; newer messages coalesce meanwhile
+        if (atomic_load_explicit(&inflight, memory_order_acquire) >= (unsigned)max_inflight) {
+            atomic_fetch_add_explicit(&inflight_waits, 1, memory_order_relaxed);
+            return false;
+        }
+
+        int player_id = ready_pop();
+        if (player_id < 0) {
+            return false;
+        }
+
+        uint64_t entry = atomic_exchange_explicit(&mailbox[player_id], 0, memory_order_acquire);
+        if (!entry || entry == MAILBOX_CANCELLED) {
+            continue;
+        }
+        const Payload *payload = (const Payload *)(uintptr_t)(entry & MAILBOX_PAYLOAD_MASK);
+        int logical_building = (int)((entry & MAILBOX_BUILDING_MASK) >> MAILBOX_BUILDING_SHIFT);
+        size_t header_len = payload_header(payload, logical_building, header_buf);
+
+        if (backend->async_acks) {
+            atomic_fetch_add_explicit(&inflight, 1, memory_order_relaxed);
+        }
+        uint64_t queued_at = atomic_load_explicit(&submitted_at[player_id], memory_order_relaxed);
+        if (backend->publish(player_id, header_buf, header_len, payload, qos[payload->msg_class]) != 0) {
+            if (backend->async_acks) {
+                atomic_fetch_sub_explicit(&inflight, 1, memory_order_relaxed);
+            }
+            atomic_fetch_add_explicit(&errors, 1, memory_order_relaxed);
+        } else {
+            atomic_fetch_add_explicit(&published, 1, memory_order_relaxed);
+            metrics_record(&metrics, STAGE_PUBLISH, metrics_now() - queued_at);
+            if (!backend->async_acks) {
+                atomic_fetch_add_explicit(&acked, 1, memory_order_relaxed);
+            }
+        }
+    }
+    return !ready_empty();
+}
+
+/**
+ * Allocate the mailboxes, ready queue and wakeup eventfd
+ * Returns 0 on success, -1 on failure
+ */
+int publisher_start(const PublishBackend *publish_backend, int max_players,
+                    int room_qos, int error_qos, int inflight_limit) {
+    size_t capacity = 2;
+    while (capacity < (size_t)max_players) {
+        capacity <<= 1;
+    }
+
+    mailbox = calloc(max_players, sizeof(*mailbox));
+    submitted_at = calloc(max_players, sizeof(*submitted_at));
+    ready = calloc(capacity, sizeof(ReadySlot));
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (!mailbox || !submitted_at || !ready || wake_fd < 0) {
+        free(mailbox);
+        free(submitted_at);
+        free(ready);
+        if (wake_fd >= 0) {
+            close(wake_fd);
+            wake_fd = -1;
+        }
+        return -1;
+    }
+    for (size_t i = 0; i < capacity; i++) {
+        atomic_init(&ready[i].sequence, i);
+    }
+
+    if (metrics_register(&metrics) != 0) {
+        syslog(LOG_ERR, "Error: No room in the metrics registry for the publisher");
+        free(mailbox);
+        free(submitted_at);
+        free(ready);
+        close(wake_fd);
+        wake_fd = -1;
+        return -1;
+    }
+
+    backend = publish_backend;
+    qos[PAYLOAD_ROOM] = room_qos;
+    qos[PAYLOAD_ERROR] = error_qos;
+    max_inflight = inflight_limit > 0 ? inflight_limit : 1;
+    ready_mask = capacity - 1;
+    atomic_store(&wake_pending, false);
+    started = true;
+    return 0;
+}
+
+/**
+ * Release the publisher; call after the workers have stopped and the
+ * control loop has sent what it could
+ */
+void publisher_stop(void) {
+    if (!started) {
+        return;
+    }
+    close(wake_fd);
+    wake_fd = -1;
+
+    free(mailbox);
+    free(submitted_at);
+    free(ready);
+    started = false;
+}
+
+/**
+ * Queue a message for a player, replacing any message not yet sent,
+ * unless this is an error and that one a room description
+ */
+void publisher_submit(int player_id, const Payload *payload) {
+    publisher_submit_room(player_id, payload, 0);
+}
+
+/**
+ * Queue a room description whose header names the building as the
+ * player's building order numbers it (logical_building, from 0)
+ */
+void publisher_submit_room(int player_id, const Payload *payload, int logical_building) {
+    atomic_fetch_add_explicit(&submitted, 1, memory_order_relaxed);
+
+    uint64_t entry = (uint64_t)(uintptr_t)payload | (uint64_t)logical_building << MAILBOX_BUILDING_SHIFT;
+    if (payload->msg_class == PAYLOAD_ERROR) {
+        entry |= MAILBOX_ERROR;
+    }
+    uint64_t old = atomic_load_explicit(&mailbox[player_id], memory_order_relaxed);
+    do {
+        if ((entry & MAILBOX_ERROR) && old && old != MAILBOX_CANCELLED && !(old & MAILBOX_ERROR)) {
+            atomic_fetch_add_explicit(&coalesced, 1, memory_order_relaxed);
+            return; // Keep the room description
+        }
+        atomic_store_explicit(&submitted_at[player_id], metrics_now(), memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak_explicit(&mailbox[player_id], &old, entry,
+                                                    memory_order_release, memory_order_relaxed));
+    if (old) {
+        // Already in the ready queue
+        if (old != MAILBOX_CANCELLED) {
+            atomic_fetch_add_explicit(&coalesced, 1, memory_order_relaxed);
+        }
+        return;
+    }
+
+    if (!ready_push(player_id)) {
+        atomic_store_explicit(&mailbox[player_id], 0, memory_order_relaxed);
+        atomic_fetch_add_explicit(&errors, 1, memory_order_relaxed);
+        ASYNC_LOG(LOG_ERR, "Publisher queue full, message for player %d dropped", player_id);
+        return;
+    }
+    wake_publisher();
+}
+
+/**
+ * Drop any message not yet sent to a player whose session ended
+ */
+void publisher_cancel(int player_id) {
+    // A queued ID stays queued, so the mailbox must stay non-empty until
+    // the control loop pops it; otherwise the next player in the slot
+    // would push the ID a second time
+    uint64_t old = atomic_load_explicit(&mailbox[player_id], memory_order_relaxed);
+    while (old && old != MAILBOX_CANCELLED &&
+           !atomic_compare_exchange_weak_explicit(&mailbox[player_id], &old, MAILBOX_CANCELLED,
+                                                  memory_order_relaxed, memory_order_relaxed)) {
+    }
+}
+
+/**
+ * Snapshot the publisher's counters
+ */
+void publisher_get_stats(PublisherStats *stats) {
+    stats->submitted = atomic_load_explicit(&submitted, memory_order_relaxed);
+    stats->coalesced = atomic_load_explicit(&coalesced, memory_order_relaxed);
+    stats->published = atomic_load_explicit(&published, memory_order_relaxed);
+    stats->errors = atomic_load_explicit(&errors, memory_order_relaxed);
+    stats->acked = atomic_load_explicit(&acked, memory_order_relaxed);
+    stats->inflight_waits = atomic_load_explicit(&inflight_waits, memory_order_relaxed);
+    stats->queue_depth = (uint32_t)(atomic_load_explicit(&enqueue_pos, memory_order_relaxed) -
+                                    atomic_load_explicit(&dequeue_pos, memory_order_relaxed));
+    stats->queue_high_water = atomic_load_explicit(&queue_high_water, memory_order_relaxed);
+    stats->inflight = atomic_load_explicit(&inflight, memory_order_relaxed);
+}
@@ -0,0 +1,44 @@
+/**
+ * publisher.h - Pipelined publisher
+ *
+ * Workers hand messages to the publisher and return immediately; the
+ * control loop passes them to the publish backend. Each player has a one-message
+ * mailbox, so a new message for a player whose previous one has not been
+ * sent yet replaces it, except that an error never replaces a room
+ * description.
+ */
+#ifndef PUBLISHER_H
+#define PUBLISHER_H
+#include <stdbool.h>
+#include <stdint.h>
+#include "payload_cache.h"
+#include "publish_backend.h"
+
+typedef struct {
+    uint64_t submitted;     // Messages handed to publisher_submit()
+    uint64_t coalesced;     // Messages replaced by a newer one, or errors dropped for a room, before being sent
+    uint64_t published;     // Messages passed to the backend
+    uint64_t errors;        // Backend publish failures
+    uint64_t acked;         // Messages the backend has completed
+    uint64_t inflight_waits; // Times the publisher paused for the inflight limit
+    uint32_t queue_depth;   // Players currently waiting to be published
+    uint32_t queue_high_water;
+    uint32_t inflight;      // Published but not yet acknowledged
+} PublisherStats;
+
+// Function prototypes
+int publisher_start(const PublishBackend *backend, int max_players,
+                    int room_qos, int error_qos, int max_inflight);
+void publisher_stop(void);
+int publisher_fd(void);
+bool publisher_run(int budget);
+bool publisher_pending(void);
+void publisher_submit(int player_id, const Payload *payload);
+void publisher_submit_room(int player_id, const Payload *payload, int logical_building);
+void publisher_cancel(int player_id);
+void publisher_acked(void);
+void publisher_get_stats(PublisherStats *stats);
+size_t publisher_queue_mark(void);
+bool publisher_queue_passed(size_t mark);
+
+#endif /* PUBLISHER_H */
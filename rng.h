@@ -0,0 +1,80 @@
+/**
+ * rng.h - Small, fast, seedable random number generator
+ *
+ * xoshiro256** (Blackman and Vigna), seeded through splitmix64. Each
+ * generator is a plain 32-byte struct owned by one thread, so there is no
+ * shared state to lock, and the same seed always replays the same
+ * sequence.
+ */
+#ifndef RNG_H
+#define RNG_H
+#include <stdint.h>
+
+typedef struct {
+    uint64_t s[4];
+} Rng;
+
+/**
+ * Advance a splitmix64 state and return its next output
+ */
+static inline uint64_t splitmix64(uint64_t *state) {
+    uint64_t z = (*state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * Derive an independent seed for a numbered stream of a master seed
+ */
+static inline uint64_t rng_derive(uint64_t seed, uint64_t stream) {
+    uint64_t state = seed ^ (stream * 0xD1B54A32D192ED03ULL);
+    return splitmix64(&state);
+}
+
+/**
+ * Seed a generator; any seed, including 0, gives a valid state
+ */
+static inline void rng_seed(Rng *rng, uint64_t seed) {
+    for (int i = 0; i < 4; i++) {
+        rng->s[i] = splitmix64(&seed);
+    }
+}
+
+static inline uint64_t rng_rotl(uint64_t x, int k) {
+    return (x << k) | (x >> (64 - k));
+}
+
+/**
+ * Next 64 random bits
+ */
+static inline uint64_t rng_next(Rng *rng) {
+    uint64_t *s = rng->s;
+    uint64_t result = rng_rotl(s[1] * 5, 7) * 9;
+    uint64_t t = s[1] << 17;
+
+    s[2] ^= s[0];
+    s[3] ^= s[1];
+    s[1] ^= s[2];
+    s[0] ^= s[3];
+    s[2] ^= t;
+    s[3] = rng_rotl(s[3], 45);
+    return result;
+}
+
+/**
+ * Uniform random number in [0, bound), bound > 0
+ * Lemire's multiply-shift with rejection: no division in the common case
+ */
+static inline uint32_t rng_below(Rng *rng, uint32_t bound) {
+    uint64_t m = (rng_next(rng) >> 32) * bound;
+    if ((uint32_t)m < bound) {
+        uint32_t threshold = -bound % bound;
+        while ((uint32_t)m < threshold) {
+            m = (rng_next(rng) >> 32) * bound;
+        }
+    }
+    return (uint32_t)(m >> 32);
+}
+
+#endif /* RNG_H */
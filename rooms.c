@@ -0,0 +1,185 @@
+/**
+ * rooms.c - Shared room helpers for all buildings
+ *
+ * This file contains the room functions that are common to every building,
+ * and the compiled transition table that replaces calling each building's
+ * get_next_room switch on every move.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "rooms.h"
+
+_Static_assert(MAX_ROOMS <= WORLD_MAX_ROOMS && MAX_BUILDINGS <= WORLD_MAX_BUILDINGS,
+               "The built-in buildings must fit the world limits");
+_Static_assert(MAX_DESCRIPTION_LENGTH <= UINT16_MAX, "RoomRecord.desc_len is uint16_t");
+
+static const char direction_chars[NUM_DIRECTIONS] = { 'n', 's', 'e', 'w' };
+
+/**
+ * Convert a direction character (either case) to a Direction
+ * Returns -1 if the character is not a direction
+ */
+int direction_from_char(char c) {
+    switch (c) {
+        case 'N':
+        case 'n': return DIR_NORTH;
+        case 'S':
+        case 's': return DIR_SOUTH;
+        case 'E':
+        case 'e': return DIR_EAST;
+        case 'W':
+        case 'w': return DIR_WEST;
+        default: return -1;
+    }
+}
+
+/**
+ * Convert a Direction back to the lowercase character the buildings use
+ */
+char direction_to_char(int direction) {
+    if (direction < 0 || direction >= NUM_DIRECTIONS) {
+        return '\0';
+    }
+    return direction_chars[direction];
+}
+
+/**
+ * Fill a built-in building's MAX_ROOMS exits from its get_next_room
+ * Targets outside the building are logged and turned into NO_EXIT
+ */
+void build_building_exits(RoomExits exits[], int building, next_room_fn next_room) {
+    for (int room_idx = 0; room_idx < MAX_ROOMS; room_idx++) {
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            int target = next_room(room_idx + 1, direction_chars[dir]);
+
+            if (target != CONNECTOR_EXIT && (target < NO_EXIT || target > MAX_ROOMS)) {
+                syslog(LOG_WARNING, "Building %d room %d has invalid exit %c -> %d, ignoring",
+                       building + 1, room_idx + 1, direction_chars[dir], target);
+                target = NO_EXIT;
+            }
+
+            exits[room_idx][dir] = target;
+        }
+    }
+}
+
+/**
+ * Compile a building module's Room into a compact RoomRecord,
+ * interning its descriptions into strings
+ * Returns 0 on success, -1 if out of memory
+ */
+int compile_room_record(RoomRecord *record, const Room *room, StringArena *strings) {
+    const char *descs[NUM_DIRECTIONS] = {
+        room->north_desc, room->south_desc, room->east_desc, room->west_desc
+    };
+
+    // Cleared so the reserved bytes are zero in world images
+    memset(record, 0, sizeof(*record));
+    for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+        size_t len = strnlen(descs[dir], MAX_DESCRIPTION_LENGTH - 1);
+        int64_t offset = string_arena_intern(strings, descs[dir], len);
+        if (offset < 0) {
+            return -1;
+        }
+        record->desc_offset[dir] = (uint32_t)offset;
+        record->desc_len[dir] = (uint16_t)len;
+    }
+
+    record->id = (uint32_t)room->id;
+    record->flags = (room->is_start_room ? ROOM_START : 0) |
+                    (room->is_item_room ? ROOM_ITEM : 0) |
+                    (room->is_connector_room ? ROOM_CONNECTOR : 0);
+    record->connected_building_id = room->connected_building_id;
+    return 0;
+}
+
+/**
+ * Index a world's start rooms and connector targets
+ * A connector whose target is not a building is indexed as no connector,
+ * the same as the server has always treated it
+ * Returns 0 on success, -1 if out of memory
+ */
+int build_room_index(RoomIndex *index, const RoomMap *map) {
+    index->start_room = malloc(map->num_buildings * sizeof(int32_t));
+    index->connector_target = malloc(room_map_size(map) * sizeof(int32_t));
+    if (!index->start_room || !index->connector_target) {
+        syslog(LOG_ERR, "Error: Out of memory indexing rooms");
+        room_index_free(index);
+        return -1;
+    }
+
+    for (int b = 0; b < map->num_buildings; b++) {
+        index->start_room[b] = 0;
+        for (int r = map->rooms_per_building; r >= 1; r--) {
+            const RoomRecord *room = room_map_room(map, b, r);
+            if (room->flags & ROOM_START) {
+                index->start_room[b] = room->id;
+            }
+
+            int target = room->connected_building_id - 1;
+            bool connects = (room->flags & ROOM_CONNECTOR) && target >= 0 && target < map->num_buildings;
+            index->connector_target[room_map_slot(map, b, r)] = connects ? target : -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Release a room index
+ */
+void room_index_free(RoomIndex *index) {
+    free(index->start_room);
+    free(index->connector_target);
+    index->start_room = NULL;
+    index->connector_target = NULL;
+}
+
+/**
+ * Get the room description based on the current room and direction
+ */
+const char* get_room_description(Room rooms[], int current_room, char direction) {
+    // Find the room index (array index is room ID - 1)
+    int room_idx = current_room - 1;
+    // Make sure room index is valid
+    if (room_idx < 0 || room_idx >= MAX_ROOMS) {
+        return "Invalid room!";
+    }
+    // Return the appropriate description based on direction
+    switch(direction) {
+        case 'n': return rooms[room_idx].north_desc;
+        case 's': return rooms[room_idx].south_desc;
+        case 'e': return rooms[room_idx].east_desc;
+        case 'w': return rooms[room_idx].west_desc;
+        default: return "Invalid direction!";
+    }
+}
+
+/**
+ * Check if a room is a connector room
+ */
+bool is_connector_room(Room rooms[], int room_id) {
+    if (room_id < 1 || room_id > MAX_ROOMS) {
+        return false;
+    }
+
+    return rooms[room_id - 1].is_connector_room;
+}
+
+/**
+ * Get the building ID that this room connects to
+ * Returns 0 if the room doesn't connect to another building
+ */
+int get_connected_building(Room rooms[], int room_id) {
+    if (room_id < 1 || room_id > MAX_ROOMS) {
+        return 0;
+    }
+
+    if (!rooms[room_id - 1].is_connector_room) {
+        return 0;
+    }
+
+    return rooms[room_id - 1].connected_building_id;
+}
@@ -7,10 +7,31 @@
 #ifndef ROOMS_H
 #define ROOMS_H
 #include <stdbool.h>
-#define MAX_ROOMS 10
+#include <stdint.h>
+#include "string_arena.h"
+#define MAX_ROOMS 10       // Rooms in each built-in building
+#define MAX_BUILDINGS 4    // Built-in buildings
 #define MAX_DESCRIPTION_LENGTH 256
 
-// Room structure - extended to include building connections
+// Limits for worlds sized at load time: world images and generated worlds
+#define WORLD_MAX_BUILDINGS 4096
+#define WORLD_MAX_ROOMS (1 << 24)    // Rooms in the whole world
+
+// Exit codes stored in the transition table (same as get_next_room_buildingN)
+#define NO_EXIT 0
+#define CONNECTOR_EXIT -1
+
+// Directions, used as the last index of the transition table
+typedef enum {
+    DIR_NORTH,
+    DIR_SOUTH,
+    DIR_EAST,
+    DIR_WEST,
+    NUM_DIRECTIONS
+} Direction;
+
+// Room structure - extended to include building connections.
+// Each building module fills these in; the server compiles them into RoomRecords.
 typedef struct {
     int id;
     char north_desc[MAX_DESCRIPTION_LENGTH];
@@ -23,6 +44,22 @@ typedef struct {
     int connected_building_id;  // Added to maintain connectivity between buildings
 } Room;
 
+// Room flags
+#define ROOM_START 0x01
+#define ROOM_ITEM 0x02
+#define ROOM_CONNECTOR 0x04
+
+// Compact room record used at run time; the descriptions are interned in a
+// StringArena so each room is 36 bytes instead of over 1 KB
+typedef struct {
+    uint32_t desc_offset[NUM_DIRECTIONS]; // Offsets into the world's string arena
+    uint16_t desc_len[NUM_DIRECTIONS];
+    uint32_t id;                          // Room ID within its building, from 1
+    int32_t connected_building_id;        // Logical building ID (1-based), 0 if none
+    uint8_t flags;                        // ROOM_START | ROOM_ITEM | ROOM_CONNECTOR
+    uint8_t reserved[3];                  // Zero
+} RoomRecord;
+
 // Function prototypes
 // These are implemented by each team member for their respective buildings
 void initialize_rooms_building1(Room rooms[]);
@@ -30,11 +67,88 @@ void initialize_rooms_building2(Room rooms[]);
 void initialize_rooms_building3(Room rooms[]);
 void initialize_rooms_building4(Room rooms[]);
 
-int get_next_room(int current_room, char direction);
+int get_next_room_building1(int current_room, char direction);
+int get_next_room_building2(int current_room, char direction);
+int get_next_room_building3(int current_room, char direction);
+int get_next_room_building4(int current_room, char direction);
+
 const char* get_room_description(Room rooms[], int current_room, char direction);
 
+// Transition table: one RoomExits per room, giving the next room ID per
+// direction, NO_EXIT or CONNECTOR_EXIT. Built once from each building's
+// get_next_room, generated, or read from a mapped world image.
+typedef int (*next_room_fn)(int current_room, char direction);
+typedef int32_t RoomExits[NUM_DIRECTIONS];
+
+void build_building_exits(RoomExits exits[], int building, next_room_fn next_room);
+int direction_from_char(char c);
+char direction_to_char(int direction);
+
+// A world's rooms and exits as the server uses them. Every building has
+// rooms_per_building rooms, stored one building after another.
+typedef struct {
+    int num_buildings;
+    int rooms_per_building;
+    const RoomRecord *rooms;
+    const RoomExits *exits;
+} RoomMap;
+
+/**
+ * Rooms in the whole world
+ */
+static inline size_t room_map_size(const RoomMap *map) {
+    return (size_t)map->num_buildings * map->rooms_per_building;
+}
+
+/**
+ * Index of a room in rooms[] and exits[]; room IDs start at 1
+ */
+static inline size_t room_map_slot(const RoomMap *map, int building, int room_id) {
+    return (size_t)building * map->rooms_per_building + room_id - 1;
+}
+
+/**
+ * Get a room's record; room IDs start at 1
+ */
+static inline const RoomRecord *room_map_room(const RoomMap *map, int building, int room_id) {
+    return &map->rooms[room_map_slot(map, building, room_id)];
+}
+
+/**
+ * Look up the next room for a move; room IDs start at 1
+ */
+static inline int lookup_next_room(const RoomMap *map, int building, int current_room, int direction) {
+    return map->exits[room_map_slot(map, building, current_room)][direction];
+}
+
 // Building connection functions
 bool is_connector_room(Room rooms[], int room_id);
 int get_connected_building(Room rooms[], int room_id);
 
+int compile_room_record(RoomRecord *record, const Room *room, StringArena *strings);
+
+// Lookups derived from a world's room records, so joining or changing
+// buildings never scans a building's rooms
+typedef struct {
+    int32_t *start_room;        // [building]: first start room ID, 0 if the building has none
+    int32_t *connector_target;  // [room slot]: logical building (0-based) a room leads to, -1 if none
+} RoomIndex;
+
+int build_room_index(RoomIndex *index, const RoomMap *map);
+void room_index_free(RoomIndex *index);
+
+/**
+ * Room a player enters a building at: its start room, or room 1 if it has none
+ */
+static inline int room_index_entry(const RoomIndex *index, int building) {
+    return index->start_room[building] ? index->start_room[building] : 1;
+}
+
+/**
+ * Get one of a compiled room's descriptions
+ */
+static inline const char *room_record_desc(const RoomRecord *record, const StringArena *strings, int direction) {
+    return string_arena_get(strings, record->desc_offset[direction]);
+}
+
 #endif /* ROOMS_H */
@@ -0,0 +1,179 @@
+/**
+ * string_arena.c - Interned string storage
+ *
+ * Offset 0 always holds the empty string. The dedup index is only needed
+ * while strings are being added; string_arena_seal() drops it and trims
+ * the buffer once the world is built.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "string_arena.h"
+
+#define ARENA_INITIAL_SIZE 4096
+#define INDEX_INITIAL_SIZE 256
+
+/**
+ * FNV-1a hash of a string
+ */
+static uint64_t string_hash(const char *str, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (unsigned char)str[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Allocate an empty arena
+ * Returns 0 on success, -1 if out of memory
+ */
+int string_arena_init(StringArena *arena) {
+    arena->data = malloc(ARENA_INITIAL_SIZE);
+    arena->index = calloc(INDEX_INITIAL_SIZE, sizeof(uint32_t));
+    if (!arena->data || !arena->index) {
+        free(arena->data);
+        free(arena->index);
+        return -1;
+    }
+
+    arena->data[0] = '\0'; // Offset 0 is the empty string
+    arena->len = 1;
+    arena->cap = ARENA_INITIAL_SIZE;
+    arena->index_cap = INDEX_INITIAL_SIZE;
+    arena->count = 0;
+    return 0;
+}
+
+/**
+ * Release the arena's memory
+ */
+void string_arena_free(StringArena *arena) {
+    if (arena->cap) {
+        free(arena->data);
+    }
+    free(arena->index);
+    arena->data = NULL;
+    arena->index = NULL;
+    arena->len = arena->cap = arena->index_cap = arena->count = 0;
+}
+
+/**
+ * Insert an offset into the dedup index, assuming it is not there yet
+ */
+static void index_insert(uint32_t *index, size_t index_cap, uint64_t hash, uint32_t offset) {
+    size_t mask = index_cap - 1;
+    size_t i = hash & mask;
+
+    while (index[i] != 0) {
+        i = (i + 1) & mask;
+    }
+    index[i] = offset + 1;
+}
+
+/**
+ * Double the dedup index once it is half full
+ */
+static int index_grow(StringArena *arena) {
+    size_t new_cap = arena->index_cap * 2;
+    uint32_t *new_index = calloc(new_cap, sizeof(uint32_t));
+    if (!new_index) {
+        return -1;
+    }
+
+    for (size_t i = 0; i < arena->index_cap; i++) {
+        if (arena->index[i] != 0) {
+            uint32_t offset = arena->index[i] - 1;
+            const char *str = arena->data + offset;
+            index_insert(new_index, new_cap, string_hash(str, strlen(str)), offset);
+        }
+    }
+
+    free(arena->index);
+    arena->index = new_index;
+    arena->index_cap = new_cap;
+    return 0;
+}
+
+/**
+ * Store a string, or find the copy already stored
+ * Returns its offset, or -1 if out of memory or the arena is sealed
+ */
+int64_t string_arena_intern(StringArena *arena, const char *str, size_t len) {
+    if (len == 0) {
+        return 0;
+    }
+    if (!arena->index) {
+        return -1;
+    }
+
+    uint64_t hash = string_hash(str, len);
+    size_t mask = arena->index_cap - 1;
+
+    for (size_t i = hash & mask; arena->index[i] != 0; i = (i + 1) & mask) {
+        uint32_t offset = arena->index[i] - 1;
+        if (strncmp(arena->data + offset, str, len) == 0 && arena->data[offset + len] == '\0') {
+            return offset;
+        }
+    }
+
+    if (arena->len + len + 1 > UINT32_MAX) {
+        return -1;
+    }
+
+    if (arena->len + len + 1 > arena->cap) {
+        size_t new_cap = arena->cap * 2;
+        while (new_cap < arena->len + len + 1) {
+            new_cap *= 2;
+        }
+        char *new_data = realloc(arena->data, new_cap);
+        if (!new_data) {
+            return -1;
+        }
+        arena->data = new_data;
+        arena->cap = new_cap;
+    }
+
+    if ((arena->count + 1) * 2 > arena->index_cap && index_grow(arena) != 0) {
+        return -1;
+    }
+
+    uint32_t offset = (uint32_t)arena->len;
+    memcpy(arena->data + offset, str, len);
+    arena->data[offset + len] = '\0';
+    arena->len += len + 1;
+
+    index_insert(arena->index, arena->index_cap, hash, offset);
+    arena->count++;
+    return offset;
+}
+
+/**
+ * Finish building: drop the dedup index and trim the buffer to size
+ * No more strings can be added afterwards
+ */
+void string_arena_seal(StringArena *arena) {
+    free(arena->index);
+    arena->index = NULL;
+    arena->index_cap = 0;
+
+    char *trimmed = realloc(arena->data, arena->len);
+    if (trimmed) {
+        arena->data = trimmed;
+        arena->cap = arena->len;
+    }
+}
+
+/**
+ * Use strings stored elsewhere (such as a mapped world image) as a sealed arena
+ * The memory is not copied or freed and must outlive the arena
+ */
+void string_arena_attach(StringArena *arena, const char *data, size_t len, size_t count) {
+    arena->data = (char *)data;
+    arena->len = len;
+    arena->cap = 0;
+    arena->index = NULL;
+    arena->index_cap = 0;
+    arena->count = count;
+}
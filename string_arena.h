@@ -0,0 +1,36 @@
+/**
+ * string_arena.h - Interned string storage
+ *
+ * Strings are appended to one contiguous buffer and identified by their
+ * byte offset. Interning the same text twice returns the first copy's
+ * offset, so repeated room descriptions are stored once.
+ */
+#ifndef STRING_ARENA_H
+#define STRING_ARENA_H
+#include <stddef.h>
+#include <stdint.h>
+
+typedef struct {
+    char *data;          // Every string, each followed by a NUL
+    size_t len;          // Bytes used in data
+    size_t cap;          // Bytes allocated for data; 0 if data is borrowed
+    uint32_t *index;     // Dedup hash table of offsets + 1, 0 = empty
+    size_t index_cap;    // Always a power of two
+    size_t count;        // Unique strings stored
+} StringArena;
+
+// Function prototypes
+int string_arena_init(StringArena *arena);
+void string_arena_free(StringArena *arena);
+int64_t string_arena_intern(StringArena *arena, const char *str, size_t len);
+void string_arena_seal(StringArena *arena);
+void string_arena_attach(StringArena *arena, const char *data, size_t len, size_t count);
+
+/**
+ * Get the string stored at an offset
+ */
+static inline const char *string_arena_get(const StringArena *arena, uint32_t offset) {
+    return arena->data + offset;
+}
+
+#endif /* STRING_ARENA_H */
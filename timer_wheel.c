@@ -0,0 +1,139 @@
+/**
+ * timer_wheel.c - Hashed timer wheel for session timeouts
+ *
+ * An entry lives in slot (deadline % TIMER_WHEEL_SLOTS), on an intrusive
+ * doubly-linked list threaded through the next[]/prev[] arrays. Deadlines
+ * more than one turn of the wheel away simply stay in their slot until
+ * the wheel comes around to the right turn.
+ */
+
+#include <stdlib.h>
+#include "timer_wheel.h"
+
+/**
+ * Allocate a wheel for entries 0 .. max_entries-1, starting at tick now
+ * Returns 0 on success, -1 if out of memory
+ */
+int timer_wheel_init(TimerWheel *wheel, size_t max_entries, uint32_t now) {
+    size_t n = max_entries ? max_entries : 1;
+
+    wheel->next = malloc(n * sizeof(int32_t));
+    wheel->prev = malloc(n * sizeof(int32_t));
+    wheel->deadline = malloc(n * sizeof(uint32_t));
+    if (!wheel->next || !wheel->prev || !wheel->deadline) {
+        timer_wheel_free(wheel);
+        return -1;
+    }
+
+    for (int i = 0; i < TIMER_WHEEL_SLOTS; i++) {
+        wheel->head[i] = TIMER_NONE;
+    }
+    for (size_t i = 0; i < n; i++) {
+        wheel->next[i] = TIMER_NONE;
+        wheel->prev[i] = TIMER_UNLINKED;
+    }
+
+    wheel->max_entries = max_entries;
+    wheel->now = now;
+    return 0;
+}
+
+/**
+ * Release the wheel's memory
+ */
+void timer_wheel_free(TimerWheel *wheel) {
+    free(wheel->next);
+    free(wheel->prev);
+    free(wheel->deadline);
+    wheel->next = NULL;
+    wheel->prev = NULL;
+    wheel->deadline = NULL;
+    wheel->max_entries = 0;
+}
+
+/**
+ * Link an entry at the front of its deadline's slot
+ */
+static void timer_link(TimerWheel *wheel, int id) {
+    int slot = wheel->deadline[id] & (TIMER_WHEEL_SLOTS - 1);
+
+    wheel->next[id] = wheel->head[slot];
+    wheel->prev[id] = TIMER_NONE;
+    if (wheel->head[slot] != TIMER_NONE) {
+        wheel->prev[wheel->head[slot]] = id;
+    }
+    wheel->head[slot] = id;
+}
+
+/**
+ * Remove an entry from the wheel; does nothing if it is not scheduled
+ */
+void timer_wheel_cancel(TimerWheel *wheel, int id) {
+    if (wheel->prev[id] == TIMER_UNLINKED) {
+        return;
+    }
+
+    int next = wheel->next[id];
+    int prev = wheel->prev[id];
+
+    if (prev == TIMER_NONE) {
+        wheel->head[wheel->deadline[id] & (TIMER_WHEEL_SLOTS - 1)] = next;
+    } else {
+        wheel->next[prev] = next;
+    }
+    if (next != TIMER_NONE) {
+        wheel->prev[next] = prev;
+    }
+
+    wheel->next[id] = TIMER_NONE;
+    wheel->prev[id] = TIMER_UNLINKED;
+}
+
+/**
+ * Schedule an entry to expire at tick deadline, replacing any earlier deadline
+ */
+void timer_wheel_schedule(TimerWheel *wheel, int id, uint32_t deadline) {
+    timer_wheel_cancel(wheel, id);
+    wheel->deadline[id] = deadline;
+    timer_link(wheel, id);
+}
+
+/**
+ * Move the wheel forward to tick now, calling expired() for every entry
+ * whose deadline has passed. Expired entries are unscheduled before the
+ * callback runs. Returns the number of entries expired
+ */
+int timer_wheel_advance(TimerWheel *wheel, uint32_t now, timer_expired_fn expired, void *ctx) {
+    int fired = 0;
+    uint32_t ticks = now - wheel->now;
+
+    // After a long gap, one pass over every slot is enough
+    if (ticks > TIMER_WHEEL_SLOTS) {
+        ticks = TIMER_WHEEL_SLOTS;
+    }
+
+    for (uint32_t t = ticks; t > 0; t--) {
+        int slot = (now - t + 1) & (TIMER_WHEEL_SLOTS - 1);
+
+        // Detach the slot so callbacks can reschedule into it safely
+        int id = wheel->head[slot];
+        wheel->head[slot] = TIMER_NONE;
+
+        while (id != TIMER_NONE) {
+            int next = wheel->next[id];
+
+            if ((int32_t)(wheel->deadline[id] - now) > 0) {
+                timer_link(wheel, id); // Due on a later turn of the wheel
+            } else {
+                wheel->next[id] = TIMER_NONE;
+                wheel->prev[id] = TIMER_UNLINKED;
+                fired++;
+                expired(id, ctx);
+            }
+            id = next;
+        }
+    }
+
+    wheel->now = now;
+    return fired;
+}
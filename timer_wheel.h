@@ -0,0 +1,37 @@
+/**
+ * timer_wheel.h - Hashed timer wheel for session timeouts
+ *
+ * Each entry is identified by a small integer (a player index) and has
+ * one deadline, measured in ticks. Scheduling, rescheduling and
+ * cancelling are O(1); advancing the wheel only visits the slots for the
+ * ticks that passed.
+ */
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+#include <stddef.h>
+#include <stdint.h>
+
+#define TIMER_WHEEL_SLOTS 64   // Power of two
+#define TIMER_NONE -1          // End of a slot's list
+#define TIMER_UNLINKED -2      // prev[] value for an entry that is not scheduled
+
+// Called for each expired entry; it may reschedule the entry
+typedef void (*timer_expired_fn)(int id, void *ctx);
+
+typedef struct {
+    int32_t head[TIMER_WHEEL_SLOTS];  // First entry in each slot
+    int32_t *next;
+    int32_t *prev;                    // TIMER_UNLINKED if not scheduled
+    uint32_t *deadline;               // Tick at which each entry expires
+    size_t max_entries;
+    uint32_t now;                     // Last tick processed
+} TimerWheel;
+
+// Function prototypes
+int timer_wheel_init(TimerWheel *wheel, size_t max_entries, uint32_t now);
+void timer_wheel_free(TimerWheel *wheel);
+void timer_wheel_schedule(TimerWheel *wheel, int id, uint32_t deadline);
+void timer_wheel_cancel(TimerWheel *wheel, int id);
+int timer_wheel_advance(TimerWheel *wheel, uint32_t now, timer_expired_fn expired, void *ctx);
+
+#endif /* TIMER_WHEEL_H */
@@ -0,0 +1,164 @@
+/**
+ * udp_batch.c - Batched UDP receive and send
+ *
+ * Receiving drains up to UDP_BATCH_SIZE waiting datagrams per syscall.
+ * Replies are queued in a send batch and go out together when the
+ * caller flushes, or earlier if the batch fills up. Small parts of a reply
+ * are copied into the slot; a frame's body is sent from where it lies.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include "udp_batch.h"
+#include "async_log.h"
+
+/**
+ * Point every message header at its buffer and address slot
+ */
+void udp_batch_init(UdpBatch *batch) {
+    memset(batch->msgs, 0, sizeof(batch->msgs));
+
+    for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+        batch->iov[i][0].iov_base = batch->bufs[i];
+        batch->iov[i][0].iov_len = UDP_DATAGRAM_SIZE;
+        batch->msgs[i].msg_hdr.msg_iov = batch->iov[i];
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_name = &batch->addrs[i];
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+    }
+    batch->count = 0;
+}
+
+/**
+ * Ask the kernel to stamp each datagram with its arrival time
+ * Returns 0 on success, -1 on error
+ */
+int udp_batch_enable_timestamps(int sock_fd) {
+    int on = 1;
+    return setsockopt(sock_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+}
+
+/**
+ * Get a received datagram's arrival time from its control messages
+ * Returns CLOCK_REALTIME nanoseconds, or 0 if it wasn't stamped
+ */
+uint64_t udp_batch_rx_time(struct msghdr *hdr) {
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(hdr); cmsg; cmsg = CMSG_NXTHDR(hdr, cmsg)) {
+        if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+            struct timespec ts;
+            memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+            return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Take every datagram already waiting, up to UDP_BATCH_SIZE; on a
+ * blocking socket, first wait for one to arrive. Each buffer is NUL-terminated.
+ * Returns the number received, or -1 on error (errno is set)
+ */
+int udp_batch_receive(UdpBatch *batch, int sock_fd) {
+    for (int i = 0; i < UDP_BATCH_SIZE; i++) {
+        batch->iov[i][0].iov_base = batch->bufs[i];
+        batch->iov[i][0].iov_len = UDP_DATAGRAM_SIZE - 1; // Room for the terminator
+        batch->msgs[i].msg_hdr.msg_iovlen = 1;
+        batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+        batch->msgs[i].msg_hdr.msg_control = batch->control[i];
+        batch->msgs[i].msg_hdr.msg_controllen = UDP_CONTROL_SIZE;
+    }
+
+    int n = recvmmsg(sock_fd, batch->msgs, UDP_BATCH_SIZE, MSG_WAITFORONE, NULL);
+    if (n < 0) {
+        batch->count = 0;
+        return -1;
+    }
+
+    for (int i = 0; i < n; i++) {
+        batch->bufs[i][batch->msgs[i].msg_len] = '\0';
+
+        batch->rx_time[i] = udp_batch_rx_time(&batch->msgs[i].msg_hdr);
+    }
+    batch->count = n;
+    return n;
+}
+
+/**
+ * Copy a reply into the send batch, flushing first if the batch is full
+ * Returns 0 on success, -1 if the reply is too large or the flush failed
+ */
+int udp_batch_queue(UdpBatch *batch, int sock_fd, const struct sockaddr_in *addr,
+                    const char *data, size_t len) {
+    return udp_batch_queue_frame(batch, sock_fd, addr, data, len, NULL, 0, NULL, 0);
+}
+
+/**
+ * Queue a reply of header, body and suffix, flushing first if the batch is
+ * full. The header and suffix are copied into the slot; the body is only
+ * pointed at, so it must stay unchanged until the batch is flushed.
+ * Returns 0 on success, -1 if the reply is too large or the flush failed
+ */
+int udp_batch_queue_frame(UdpBatch *batch, int sock_fd, const struct sockaddr_in *addr,
+                          const char *header, size_t header_len,
+                          const char *body, size_t body_len,
+                          const char *suffix, size_t suffix_len) {
+    if (header_len + suffix_len > UDP_DATAGRAM_SIZE ||
+        header_len + body_len + suffix_len > UDP_DATAGRAM_SIZE) {
+        return -1;
+    }
+
+    if (batch->count == UDP_BATCH_SIZE && udp_batch_flush(batch, sock_fd) != 0) {
+        return -1;
+    }
+
+    int i = batch->count++;
+    struct iovec *iov = batch->iov[i];
+    int parts = 0;
+
+    if (header_len > 0) {
+        memcpy(batch->bufs[i], header, header_len);
+    }
+    iov[parts].iov_base = batch->bufs[i];
+    iov[parts++].iov_len = header_len;
+    if (body_len > 0) {
+        iov[parts].iov_base = (void *)body;
+        iov[parts++].iov_len = body_len;
+    }
+    if (suffix_len > 0) {
+        memcpy(batch->bufs[i] + header_len, suffix, suffix_len);
+        iov[parts].iov_base = batch->bufs[i] + header_len;
+        iov[parts++].iov_len = suffix_len;
+    }
+
+    batch->msgs[i].msg_hdr.msg_iovlen = parts;
+    batch->addrs[i] = *addr;
+    batch->msgs[i].msg_hdr.msg_namelen = sizeof(batch->addrs[i]);
+    return 0;
+}
+
+/**
+ * Send every queued reply, retrying until the kernel has taken them all
+ * Returns 0 on success, -1 if some replies had to be dropped
+ */
+int udp_batch_flush(UdpBatch *batch, int sock_fd) {
+    int sent = 0;
+    int result = 0;
+
+    while (sent < batch->count) {
+        int n = sendmmsg(sock_fd, batch->msgs + sent, batch->count - sent, 0);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            // Skip the datagram the kernel refused and keep going
+            ASYNC_LOG(LOG_ERR, "Error sending UDP reply: %s", strerror(errno));
+            result = -1;
+            n = 1;
+        }
+        sent += n;
+    }
+
+    batch->count = 0;
+    return result;
+}
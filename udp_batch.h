@@ -0,0 +1,58 @@
+/**
+ * udp_batch.h - Batched UDP receive and send
+ *
+ * A UdpBatch holds a fixed array of datagram buffers and the mmsghdr
+ * vectors that point at them, so a whole batch moves through the kernel
+ * with one recvmmsg() or sendmmsg() call.
+ *
+ * An outgoing datagram is a frame of up to UDP_FRAME_PARTS pieces sent
+ * with scatter-gather: a header and a suffix written into the slot's own
+ * buffer, and between them a body the batch only points at, so long
+ * cached text is never copied or reformatted to send it.
+ */
+#ifndef UDP_BATCH_H
+#define UDP_BATCH_H
+// Needs _GNU_SOURCE defined before the first system include for struct mmsghdr
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+
+#define UDP_BATCH_SIZE 32        // Datagrams per recvmmsg()/sendmmsg() call
+#define UDP_DATAGRAM_SIZE 2048   // Largest datagram a batch slot holds
+#define UDP_CONTROL_SIZE 64      // Room for one SCM_TIMESTAMPNS control message
+#define UDP_FRAME_PARTS 3        // Header, borrowed body, suffix
+
+typedef struct {
+    struct mmsghdr msgs[UDP_BATCH_SIZE];
+    struct iovec iov[UDP_BATCH_SIZE][UDP_FRAME_PARTS];
+    struct sockaddr_in addrs[UDP_BATCH_SIZE];
+    char bufs[UDP_BATCH_SIZE][UDP_DATAGRAM_SIZE];
+    char control[UDP_BATCH_SIZE][UDP_CONTROL_SIZE];
+    uint64_t rx_time[UDP_BATCH_SIZE]; // Kernel receive time (CLOCK_REALTIME ns), 0 if unknown
+    int count;                   // Datagrams currently held
+} UdpBatch;
+
+/**
+ * Get received datagram i, NUL-terminated; it is in the batch's own
+ * buffer, or in a ring buffer when an io_uring filled the batch
+ */
+static inline char *udp_batch_data(const UdpBatch *batch, int i) {
+    return batch->iov[i][0].iov_base;
+}
+
+// Function prototypes
+void udp_batch_init(UdpBatch *batch);
+int udp_batch_enable_timestamps(int sock_fd);
+uint64_t udp_batch_rx_time(struct msghdr *hdr);
+int udp_batch_receive(UdpBatch *batch, int sock_fd);
+int udp_batch_queue(UdpBatch *batch, int sock_fd, const struct sockaddr_in *addr,
+                    const char *data, size_t len);
+int udp_batch_queue_frame(UdpBatch *batch, int sock_fd, const struct sockaddr_in *addr,
+                          const char *header, size_t header_len,
+                          const char *body, size_t body_len,
+                          const char *suffix, size_t suffix_len);
+int udp_batch_flush(UdpBatch *batch, int sock_fd);
+
+#endif /* UDP_BATCH_H */
@@ -0,0 +1,380 @@
+/**
+ * udp_uring.c - io_uring receive and send for a worker's UDP socket
+ *
+ * Each provided buffer holds what multishot recvmsg writes: an
+ * io_uring_recvmsg_out, the sender's address, the control messages (the
+ * arrival timestamp) and then the datagram. A receive hands the worker
+ * pointers into the buffers, and the buffers go back on the ring once the
+ * batch has been processed. The last byte of every buffer is kept back
+ * from the kernel so the datagram can be NUL-terminated in place.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "udp_uring.h"
+#include "async_log.h"
+
+#define BUFFER_GROUP 0
+
+// user_data of each kind of request
+#define REQUEST_RECV 1
+#define REQUEST_SEND 2
+
+/**
+ * Thin wrappers for the io_uring system calls (glibc has none)
+ */
+static int uring_setup(unsigned entries, struct io_uring_params *params) {
+    return (int)syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int uring_register(int fd, unsigned opcode, void *arg, unsigned nr_args) {
+    return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Take the next free submission entry, cleared
+ * Returns NULL if the submission queue is full
+ */
+static struct io_uring_sqe *get_sqe(UdpUring *ring) {
+    unsigned head = atomic_load_explicit((_Atomic unsigned *)ring->sq_head, memory_order_acquire);
+    if (ring->sq_local_tail - head >= ring->sq_entries) {
+        return NULL;
+    }
+
+    unsigned idx = ring->sq_local_tail & ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    ring->sq_array[idx] = idx;
+    ring->sq_local_tail++;
+    return sqe;
+}
+
+/**
+ * Hand every filled-in submission entry to the kernel
+ * Returns 0 on success, -1 on error (errno is set)
+ */
+static int submit(UdpUring *ring) {
+    atomic_store_explicit((_Atomic unsigned *)ring->sq_tail, ring->sq_local_tail, memory_order_release);
+
+    for (;;) {
+        unsigned head = atomic_load_explicit((_Atomic unsigned *)ring->sq_head, memory_order_acquire);
+        unsigned pending = ring->sq_local_tail - head;
+        if (pending == 0) {
+            return 0;
+        }
+        if (uring_enter(ring->ring_fd, pending, 0, 0) < 0 && errno != EINTR) {
+            return -1;
+        }
+    }
+}
+
+/**
+ * Put a receive buffer back on the provided buffer ring; the kernel sees
+ * it once the tail is published
+ */
+static void recycle_buffer(UdpUring *ring, uint16_t bid) {
+    struct io_uring_buf *buf = &ring->buf_ring->bufs[ring->buf_tail & (UDP_URING_BUFFERS - 1)];
+    buf->addr = (uint64_t)(uintptr_t)(ring->bufs + (size_t)bid * ring->buf_size);
+    buf->len = ring->buf_size - 1; // Room for the terminator
+    buf->bid = bid;
+    ring->buf_tail++;
+}
+
+static void publish_buffers(UdpUring *ring) {
+    atomic_store_explicit((_Atomic uint16_t *)&ring->buf_ring->tail, ring->buf_tail, memory_order_release);
+}
+
+/**
+ * Queue the multishot receive; it stays armed until the kernel ends it
+ * Returns 0 on success, -1 if it could not be submitted
+ */
+static int arm_receive(UdpUring *ring) {
+    struct io_uring_sqe *sqe = get_sqe(ring);
+    if (!sqe) {
+        return -1;
+    }
+
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = ring->sock_fd;
+    sqe->addr = (uint64_t)(uintptr_t)&ring->recv_hdr;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = BUFFER_GROUP;
+    sqe->user_data = REQUEST_RECV;
+    if (submit(ring) != 0) {
+        return -1;
+    }
+    ring->armed = true;
+    return 0;
+}
+
+/**
+ * Create the ring and register the receive buffers for a socket
+ * Returns 0 on success, -1 if io_uring is unavailable or out of memory
+ */
+int udp_uring_init(UdpUring *ring, int sock_fd) {
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+    ring->sock_fd = sock_fd;
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = UDP_URING_CQ_ENTRIES;
+    ring->ring_fd = uring_setup(UDP_URING_ENTRIES, &params);
+    if (ring->ring_fd < 0) {
+        syslog(LOG_WARNING, "io_uring unavailable: %s", strerror(errno));
+        return -1;
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_CQE_SKIP)) {
+        syslog(LOG_WARNING, "io_uring unavailable: kernel is too old");
+        udp_uring_free(ring);
+        return -1;
+    }
+
+    // Map the rings (one mapping holds both) and the submission entries
+    ring->ring_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    size_t cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (cq_size > ring->ring_map_size) {
+        ring->ring_map_size = cq_size;
+    }
+    ring->ring_map = mmap(NULL, ring->ring_map_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                          ring->ring_fd, IORING_OFF_SQ_RING);
+    ring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = mmap(NULL, ring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                      ring->ring_fd, IORING_OFF_SQES);
+    if (ring->ring_map == MAP_FAILED || ring->sqes == MAP_FAILED) {
+        syslog(LOG_WARNING, "io_uring unavailable: cannot map the rings");
+        if (ring->ring_map == MAP_FAILED) {
+            ring->ring_map = NULL;
+        }
+        if (ring->sqes == MAP_FAILED) {
+            ring->sqes = NULL;
+        }
+        udp_uring_free(ring);
+        return -1;
+    }
+    char *sq = ring->ring_map;
+    ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    ring->sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+    ring->sq_entries = params.sq_entries;
+    ring->sq_local_tail = *ring->sq_tail;
+
+    char *cq = ring->ring_map;
+    ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    ring->cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    // Each buffer: recvmsg_out header, address, control messages, datagram, terminator
+    ring->recv_hdr.msg_namelen = sizeof(struct sockaddr_in);
+    ring->recv_hdr.msg_controllen = UDP_CONTROL_SIZE;
+    ring->buf_size = sizeof(struct io_uring_recvmsg_out) + sizeof(struct sockaddr_in) +
+                     UDP_CONTROL_SIZE + UDP_DATAGRAM_SIZE;
+    ring->bufs = malloc((size_t)UDP_URING_BUFFERS * ring->buf_size);
+    if (posix_memalign((void **)&ring->buf_ring, sysconf(_SC_PAGESIZE),
+                       UDP_URING_BUFFERS * sizeof(struct io_uring_buf)) != 0) {
+        ring->buf_ring = NULL;
+    }
+    if (!ring->bufs || !ring->buf_ring) {
+        syslog(LOG_ERR, "Error: Out of memory allocating io_uring buffers");
+        udp_uring_free(ring);
+        return -1;
+    }
+    memset(ring->buf_ring, 0, UDP_URING_BUFFERS * sizeof(struct io_uring_buf));
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)ring->buf_ring;
+    reg.ring_entries = UDP_URING_BUFFERS;
+    reg.bgid = BUFFER_GROUP;
+    if (uring_register(ring->ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        syslog(LOG_WARNING, "io_uring unavailable: cannot register a provided buffer ring: %s", strerror(errno));
+        udp_uring_free(ring);
+        return -1;
+    }
+
+    for (int bid = 0; bid < UDP_URING_BUFFERS; bid++) {
+        recycle_buffer(ring, bid);
+    }
+    publish_buffers(ring);
+    return 0;
+}
+
+/**
+ * Arm the receive from the thread that will reap it, so the kernel does
+ * its completion work on that thread. A kernel that can't run multishot
+ * recvmsg rejects it at once.
+ * Returns 0 on success, -1 if the receive could not be started
+ */
+int udp_uring_start(UdpUring *ring) {
+    if (arm_receive(ring) != 0) {
+        syslog(LOG_WARNING, "io_uring receive could not be armed: %s", strerror(errno));
+        return -1;
+    }
+
+    unsigned head = *ring->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring->cq_tail, memory_order_acquire);
+    if (head != tail) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        if (cqe->user_data == REQUEST_RECV && cqe->res < 0 && !(cqe->flags & IORING_CQE_F_MORE)) {
+            syslog(LOG_WARNING, "io_uring multishot receive rejected: %s", strerror(-cqe->res));
+            atomic_store_explicit((_Atomic unsigned *)ring->cq_head, head + 1, memory_order_release);
+            ring->armed = false;
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Reap completions, putting up to UDP_BATCH_SIZE received datagrams in
+ * batch. The datagrams stay in the ring's buffers until udp_uring_release().
+ * Returns the number received
+ */
+int udp_uring_receive(UdpUring *ring, UdpBatch *batch) {
+    size_t name_offset = sizeof(struct io_uring_recvmsg_out);
+    size_t control_offset = name_offset + ring->recv_hdr.msg_namelen;
+    size_t payload_offset = control_offset + ring->recv_hdr.msg_controllen;
+    int count = 0;
+
+    unsigned head = *ring->cq_head;
+    unsigned tail = atomic_load_explicit((_Atomic unsigned *)ring->cq_tail, memory_order_acquire);
+    // Every buffer the kernel filled is recorded in taken[], skipped ones
+    // too, and each datagram delivered takes one, so this bounds both
+    while (head != tail && ring->num_taken < UDP_BATCH_SIZE) {
+        const struct io_uring_cqe *cqe = &ring->cqes[head & ring->cq_mask];
+        head++;
+
+        if (cqe->user_data == REQUEST_SEND) {
+            // Only failed sends post a completion
+            ASYNC_LOG(LOG_ERR, "Error sending UDP reply: %s", strerror(-cqe->res));
+            continue;
+        }
+
+        if (!(cqe->flags & IORING_CQE_F_MORE)) {
+            ring->armed = false; // Ended, e.g. out of buffers; udp_uring_release() re-arms it
+        }
+        if (!(cqe->flags & IORING_CQE_F_BUFFER)) {
+            if (cqe->res < 0 && cqe->res != -ENOBUFS) {
+                ASYNC_LOG(LOG_ERR, "Error receiving UDP datagram: %s", strerror(-cqe->res));
+            }
+            continue;
+        }
+
+        uint16_t bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+        ring->taken[ring->num_taken++] = bid;
+        if (cqe->res < 0 || (size_t)cqe->res < payload_offset) {
+            continue;
+        }
+
+        char *buf = ring->bufs + (size_t)bid * ring->buf_size;
+        const struct io_uring_recvmsg_out *out = (const struct io_uring_recvmsg_out *)buf;
+        size_t len = cqe->res - payload_offset;
+        buf[payload_offset + len] = '\0';
+
+        memset(&batch->addrs[count], 0, sizeof(batch->addrs[count]));
+        memcpy(&batch->addrs[count], buf + name_offset,
+               out->namelen < sizeof(batch->addrs[count]) ? out->namelen : sizeof(batch->addrs[count]));
+
+        struct msghdr control = {
+            .msg_control = buf + control_offset,
+            .msg_controllen = out->controllen,
+        };
+        batch->rx_time[count] = udp_batch_rx_time(&control);
+        batch->iov[count][0].iov_base = buf + payload_offset;
+        batch->msgs[count].msg_len = len;
+        count++;
+    }
+
+    atomic_store_explicit((_Atomic unsigned *)ring->cq_head, head, memory_order_release);
+    batch->count = count;
+    return count;
+}
+
+/**
+ * Give back the buffers of the last udp_uring_receive(), and re-arm the
+ * receive if the kernel ended it
+ */
+void udp_uring_release(UdpUring *ring) {
+    for (int i = 0; i < ring->num_taken; i++) {
+        recycle_buffer(ring, ring->taken[i]);
+    }
+    if (ring->num_taken > 0) {
+        publish_buffers(ring);
+    }
+    ring->num_taken = 0;
+
+    if (!ring->armed && arm_receive(ring) != 0) {
+        ASYNC_LOG(LOG_ERR, "Error re-arming io_uring receive: %s", strerror(errno));
+    }
+}
+
+/**
+ * Send every reply queued in batch with one submission. MSG_DONTWAIT makes
+ * each send finish or fail while it is submitted, so the batch can be
+ * reused as soon as this returns; only failures post completions.
+ * Returns 0 on success, -1 if the replies could not be submitted
+ */
+int udp_uring_send(UdpUring *ring, UdpBatch *batch) {
+    int result = 0;
+
+    for (int i = 0; i < batch->count; i++) {
+        struct io_uring_sqe *sqe = get_sqe(ring);
+        if (!sqe) {
+            if (submit(ring) != 0) {
+                result = -1;
+                break;
+            }
+            sqe = get_sqe(ring);
+        }
+
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = ring->sock_fd;
+        sqe->addr = (uint64_t)(uintptr_t)&batch->msgs[i].msg_hdr;
+        sqe->msg_flags = MSG_DONTWAIT;
+        sqe->flags = IOSQE_CQE_SKIP_SUCCESS;
+        sqe->user_data = REQUEST_SEND;
+    }
+
+    if (result == 0 && submit(ring) != 0) {
+        result = -1;
+    }
+    if (result != 0) {
+        ASYNC_LOG(LOG_ERR, "Error submitting UDP replies: %s", strerror(errno));
+    }
+    batch->count = 0;
+    return result;
+}
+
+/**
+ * Tear down the ring; the socket stays open
+ */
+void udp_uring_free(UdpUring *ring) {
+    if (ring->sqes) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->ring_map) {
+        munmap(ring->ring_map, ring->ring_map_size);
+    }
+    if (ring->ring_fd >= 0) {
+        close(ring->ring_fd);
+    }
+    free(ring->bufs);
+    free(ring->buf_ring);
+    memset(ring, 0, sizeof(*ring));
+    ring->ring_fd = -1;
+}
@@ -0,0 +1,73 @@
+/**
+ * udp_uring.h - io_uring receive and send for a worker's UDP socket
+ *
+ * An alternative to the recvmmsg()/sendmmsg() calls of udp_batch.c. One
+ * multishot recvmsg request stays armed on the socket, and the kernel
+ * writes each datagram straight into a buffer it takes from a ring of
+ * provided buffers, so receiving costs no system call at all. Replies
+ * queued in a UdpBatch go out as one submission of sendmsg requests. The
+ * ring's descriptor is pollable, so the worker still sleeps in epoll.
+ *
+ * Only the uapi header is needed, not liburing. A kernel without
+ * multishot recvmsg or provided buffer rings (before 6.0), or one where
+ * io_uring is disabled, makes udp_uring_init() or udp_uring_start() fail,
+ * and the worker goes back to udp_batch.
+ */
+#ifndef UDP_URING_H
+#define UDP_URING_H
+// Needs _GNU_SOURCE defined before the first system include for struct mmsghdr
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <linux/io_uring.h>
+#include "udp_batch.h"
+
+#define UDP_URING_ENTRIES 64      // Submission queue: a batch of sends plus the receive
+#define UDP_URING_CQ_ENTRIES 1024 // Completions the kernel can post before the worker reaps them
+#define UDP_URING_BUFFERS 256     // Provided receive buffers, a power of two
+
+typedef struct {
+    int ring_fd;
+    int sock_fd;
+    bool armed;                   // The multishot receive is still running
+
+    // Submission queue, shared with the kernel
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned sq_entries;
+    unsigned sq_local_tail;       // SQEs filled in, some not yet handed to the kernel
+
+    // Completion queue, shared with the kernel
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe *cqes;
+
+    void *ring_map;               // Both queues' rings, in one mapping
+    size_t ring_map_size;
+    size_t sqes_size;
+
+    // Provided receive buffers
+    struct io_uring_buf_ring *buf_ring;
+    char *bufs;                   // UDP_URING_BUFFERS buffers of buf_size bytes
+    size_t buf_size;
+    uint16_t buf_tail;
+    uint16_t taken[UDP_BATCH_SIZE]; // Buffers handed out by the last udp_uring_receive()
+    int num_taken;
+
+    struct msghdr recv_hdr;       // Name and control space reserved in each buffer
+} UdpUring;
+
+// Function prototypes
+int udp_uring_init(UdpUring *ring, int sock_fd);
+int udp_uring_start(UdpUring *ring);
+int udp_uring_receive(UdpUring *ring, UdpBatch *batch);
+void udp_uring_release(UdpUring *ring);
+int udp_uring_send(UdpUring *ring, UdpBatch *batch);
+void udp_uring_free(UdpUring *ring);
+
+#endif /* UDP_URING_H */
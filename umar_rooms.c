@@ -16,7 +16,7 @@
  * Get the next room based on current room and direction
  * Returns the ID of the next room, or 0 if no exit in that direction
  */
-int get_next_room(int current_room, char direction) {
+int get_next_room_building4(int current_room, char direction) {
 	switch(current_room) {
 		case 1:  //Room 1
 			switch(direction) {
@@ -116,7 +116,7 @@ int get_next_room(int current_room, char direction) {
 /**
  * Initialize the room data based on the provided diagram
  */
-void initialize_rooms(Room rooms[]) {
+void initialize_rooms_building4(Room rooms[]) {
 	// Room 1
 	rooms[0].id = 1;
 	strcpy(rooms[0].north_desc, "you go north. Ruins of a humble church. A faint Site of Grace flickers.");
@@ -268,30 +268,3 @@ const char* get_room_overview(int current_room) {
 			return "You are in an unknown place. Something is wrong.";
 	}
 }
-
-/**
- * Check if a room is a connector room
- */
-bool is_connector_room(Room rooms[], int room_id) {
-	if (room_id < 1 || room_id > MAX_ROOMS) {
-		return false;
-	}
-	
-	return rooms[room_id - 1].is_connector_room;
-}
-
-/**
- * Get the building ID that this room connects to
- * Returns 0 if the room doesn't connect to another building
- */
-int get_connected_building(Room rooms[], int room_id) {
-	if (room_id < 1 || room_id > MAX_ROOMS) {
-		return 0;
-	}
-	
-	if (!rooms[room_id - 1].is_connector_room) {
-		return 0;
-	}
-	
-	return rooms[room_id - 1].connected_building_id;
-}
@@ -0,0 +1,175 @@
+/**
+ * world.c - Per-game world instances
+ *
+ * The pool hands out world slots the same way a worker hands out player
+ * slots: released worlds go on a free list and are reused before a fresh
+ * slot is touched. A pool with one more slot than it has players can
+ * never run out, since each player holds at most one world.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "world.h"
+
+_Static_assert(WORLD_MAX_BUILDINGS <= UINT16_MAX + 1, "Layouts store building numbers as uint16_t");
+
+/**
+ * Set a world to the identity layout
+ */
+static void world_reset(World *world) {
+    for (uint32_t i = 0; i < world->num_buildings; i++) {
+        world->building_order[i] = i;
+        world->logical_of[i] = i;
+    }
+    world->refs = 0;
+}
+
+/**
+ * Allocate a pool of capacity worlds of num_buildings buildings whose
+ * generators derive from seed
+ * Returns 0 on success, -1 if out of memory
+ */
+int world_pool_init(WorldPool *pool, int capacity, int num_buildings, uint64_t seed) {
+    size_t n = capacity > 0 ? capacity : 1;
+
+    pool->worlds = malloc(n * sizeof(World));
+    pool->layouts = malloc(n * 2 * num_buildings * sizeof(uint16_t));
+    pool->free_worlds = malloc(n * sizeof(int32_t));
+    if (!pool->worlds || !pool->layouts || !pool->free_worlds) {
+        world_pool_free(pool);
+        return -1;
+    }
+
+    // Each world's two tables live in its own slice of layouts
+    for (size_t i = 0; i < n; i++) {
+        pool->worlds[i].building_order = pool->layouts + i * 2 * num_buildings;
+        pool->worlds[i].logical_of = pool->worlds[i].building_order + num_buildings;
+        pool->worlds[i].num_buildings = num_buildings;
+    }
+
+    pool->num_buildings = num_buildings;
+    pool->capacity = capacity;
+    pool->num_free = 0;
+    pool->next_unused = 0;
+    pool->in_use = 0;
+    pool->seed = seed;
+    pool->created = 0;
+    return 0;
+}
+
+/**
+ * Release the pool's memory
+ */
+void world_pool_free(WorldPool *pool) {
+    free(pool->worlds);
+    free(pool->layouts);
+    free(pool->free_worlds);
+    pool->worlds = NULL;
+    pool->layouts = NULL;
+    pool->free_worlds = NULL;
+    pool->capacity = 0;
+}
+
+/**
+ * Take a world from the pool with the identity layout, one reference and
+ * a freshly seeded generator
+ * Returns the world's ID, or -1 if the pool is exhausted
+ */
+int world_create(WorldPool *pool) {
+    int world_id;
+    if (pool->num_free > 0) {
+        world_id = pool->free_worlds[--pool->num_free];
+    } else if (pool->next_unused < pool->capacity) {
+        world_id = pool->next_unused++;
+    } else {
+        return -1;
+    }
+
+    World *world = &pool->worlds[world_id];
+    world_reset(world);
+    world->refs = 1;
+    rng_seed(&world->rng, rng_derive(pool->seed, pool->created++));
+    pool->in_use++;
+    return world_id;
+}
+
+/**
+ * Add a reference to a world
+ */
+void world_retain(WorldPool *pool, int world_id) {
+    pool->worlds[world_id].refs++;
+}
+
+/**
+ * Drop a reference to a world, returning it to the pool when none are left
+ */
+void world_release(WorldPool *pool, int world_id) {
+    World *world = &pool->worlds[world_id];
+    if (--world->refs == 0) {
+        pool->free_worlds[pool->num_free++] = world_id;
+        pool->in_use--;
+    }
+}
+
+/**
+ * Get a world that only the caller references, for changing its layout
+ * If the caller is the only holder the same world is returned; otherwise
+ * the caller's reference moves to a new copy of the layout with its own
+ * generator, so two copies never shuffle alike. Returns -1 if the pool is
+ * exhausted, in which case the caller keeps its reference to world_id.
+ */
+int world_make_private(WorldPool *pool, int world_id) {
+    if (pool->worlds[world_id].refs == 1) {
+        return world_id;
+    }
+
+    int copy_id = world_create(pool);
+    if (copy_id < 0) {
+        return -1;
+    }
+
+    World *copy = &pool->worlds[copy_id];
+    const World *original = &pool->worlds[world_id];
+    memcpy(copy->building_order, original->building_order, original->num_buildings * sizeof(uint16_t));
+    memcpy(copy->logical_of, original->logical_of, original->num_buildings * sizeof(uint16_t));
+    world_release(pool, world_id);
+    return copy_id;
+}
+
+/**
+ * Give a world a new random building order from its own generator
+ */
+void world_shuffle(World *world) {
+    for (uint32_t i = 0; i < world->num_buildings; i++) {
+        world->building_order[i] = i;
+    }
+
+    // Fisher-Yates shuffle
+    for (uint32_t i = world->num_buildings - 1; i > 0; i--) {
+        uint32_t j = rng_below(&world->rng, i + 1);
+        uint16_t temp = world->building_order[i];
+        world->building_order[i] = world->building_order[j];
+        world->building_order[j] = temp;
+    }
+
+    for (uint32_t i = 0; i < world->num_buildings; i++) {
+        world->logical_of[world->building_order[i]] = i;
+    }
+}
+
+/**
+ * Format a world's building order for the log, e.g. "B1->pos3 B2->pos1 ..."
+ * Large worlds are cut off at cap
+ */
+void world_describe(const World *world, char *buf, size_t cap) {
+    size_t len = 0;
+    buf[0] = '\0';
+    for (uint32_t i = 0; i < world->num_buildings && len < cap; i++) {
+        int n = snprintf(buf + len, cap - len, "B%d->pos%d ", i + 1, world->building_order[i] + 1);
+        if (n < 0) {
+            break;
+        }
+        len += n;
+    }
+}
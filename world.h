@@ -0,0 +1,70 @@
+/**
+ * world.h - Per-game world instances
+ *
+ * Every game shares the read-only room data of the loaded world. The only
+ * thing that makes one game's map different from another's is the order
+ * the buildings are connected in, so a World holds just that permutation
+ * and its inverse: a new game costs a few bytes, not a copy of the rooms.
+ *
+ * Worlds are reference counted and allocated from a fixed pool. Players
+ * share a world until one of them asks for a new layout; that player is
+ * then given a world of their own (copy-on-write), and nobody else's map
+ * changes.
+ *
+ * Each world draws from its own generator. World seeds come from the
+ * pool's seed and the order worlds are created in, so a game can be
+ * replayed from the pool's seed.
+ */
+#ifndef WORLD_H
+#define WORLD_H
+#include <stddef.h>
+#include <stdint.h>
+#include "rooms.h"
+#include "rng.h"
+
+typedef struct {
+    uint16_t *building_order;   // Logical building -> physical building
+    uint16_t *logical_of;       // Physical building -> logical building
+    uint32_t num_buildings;     // Entries in each of the above
+    uint32_t refs;              // Players (and owners) holding this world
+    Rng rng;                    // Shuffles and start buildings in this world
+} World;
+
+typedef struct {
+    World *worlds;
+    uint16_t *layouts;      // Every world's building_order and logical_of, back to back
+    int32_t *free_worlds;   // Worlds whose last reference was dropped
+    int num_buildings;      // Buildings in every layout, fixed for the pool's life
+    int capacity;
+    int num_free;
+    int next_unused;        // Worlds below this have been handed out at least once
+    int in_use;
+    uint64_t seed;          // Every world's seed is derived from this
+    uint64_t created;       // Worlds created so far; numbers each world's seed stream
+} WorldPool;
+
+// Function prototypes
+int world_pool_init(WorldPool *pool, int capacity, int num_buildings, uint64_t seed);
+void world_pool_free(WorldPool *pool);
+int world_create(WorldPool *pool);
+void world_retain(WorldPool *pool, int world_id);
+void world_release(WorldPool *pool, int world_id);
+int world_make_private(WorldPool *pool, int world_id);
+void world_shuffle(World *world);
+void world_describe(const World *world, char *buf, size_t cap);
+
+/**
+ * Physical building that a world places at a logical position
+ */
+static inline int world_physical(const World *world, int logical_building) {
+    return world->building_order[logical_building];
+}
+
+/**
+ * Logical position of a physical building in a world
+ */
+static inline int world_logical(const World *world, int physical_building) {
+    return world->logical_of[physical_building];
+}
+
+#endif /* WORLD_H */
@@ -0,0 +1,504 @@
+/**
+ * world_check.c - Static checks of a world's rooms and exits
+ *
+ * Rooms are numbered by their slot in the RoomMap and the exits form a
+ * graph of at most NUM_DIRECTIONS edges per room. Joining and resetting
+ * can put a player at any building's entry room, and a connector always
+ * leads to an entry room, so which rooms can be reached does not depend on
+ * the building order and is worked out once. Distances to an item do
+ * depend on it: a connector's target is a logical building, so each order
+ * gets its own backward walk from the item rooms. Small worlds are checked
+ * under every order (24 with four buildings); larger ones under a fixed
+ * sample of CHECK_LAYOUTS orders.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <syslog.h>
+#include <time.h>
+#include "world_check.h"
+#include "rng.h"
+
+#define CHECK_LAYOUTS 24               // Building orders checked at most
+#define CHECK_SEED 0x776f726c64ULL     // Sampled orders are the same on every run
+#define REPORT_LIMIT 10                // Rooms listed per kind of problem
+
+// Kinds of problem, each listed up to REPORT_LIMIT times
+enum {
+    ISSUE_ROOM_ID,
+    ISSUE_DESCRIPTION,
+    ISSUE_START_ROOM,
+    ISSUE_CONNECTOR,
+    ISSUE_UNREACHABLE,
+    ISSUE_DEAD_END,
+    ISSUE_NO_ITEM,
+    NUM_ISSUES
+};
+
+static const char *issue_names[NUM_ISSUES] = {
+    "rooms with the wrong ID",
+    "rooms missing descriptions",
+    "buildings without a start room",
+    "connector problems",
+    "unreachable rooms",
+    "dead ends",
+    "rooms with no way to an item"
+};
+
+typedef struct {
+    const RoomMap *map;
+    RoomIndex index;
+    int problems;
+    int counts[NUM_ISSUES];
+
+    int32_t (*graph)[NUM_DIRECTIONS]; // Exits within buildings: slot per direction, -1 for none
+    bool *has_connector;              // Room has an exit through a connector to a real building
+    int32_t *entries;                 // Entry room slot of each physical building
+    int32_t *pred_start;              // Backward edges within buildings, CSR by target slot
+    int32_t *preds;
+    int32_t *connector_start;         // Connector rooms, CSR by target logical building
+    int32_t *connectors;
+
+    // Walk results, per room then per building
+    bool *reached;
+    int32_t *distance;
+    int32_t *queue;
+    uint16_t *trapped_in;             // Building orders a reachable room can't get to an item in
+    int32_t *nearest;                 // Fewest and most moves from a start room to an item
+    int32_t *farthest;
+    int32_t *stranded;                // Building orders a start room can't get to an item in
+    uint16_t *order;
+    uint16_t *logical_of;
+} Check;
+
+/**
+ * Log one problem and count it; past REPORT_LIMIT of a kind, only count it
+ */
+static void report(Check *check, int kind, const char *format, ...) {
+    check->problems++;
+    if (++check->counts[kind] > REPORT_LIMIT) {
+        return;
+    }
+
+    char message[256];
+    va_list args;
+    va_start(args, format);
+    vsnprintf(message, sizeof(message), format, args);
+    va_end(args);
+    syslog(LOG_WARNING, "World check: %s", message);
+}
+
+/**
+ * Step to the next building order in lexicographic order
+ * Returns false after the last one
+ */
+static bool next_layout(uint16_t order[], int n) {
+    int i = n - 2;
+    while (i >= 0 && order[i] >= order[i + 1]) {
+        i--;
+    }
+    if (i < 0) {
+        return false;
+    }
+
+    int j = n - 1;
+    while (order[j] <= order[i]) {
+        j--;
+    }
+    uint16_t temp = order[i];
+    order[i] = order[j];
+    order[j] = temp;
+
+    for (int a = i + 1, b = n - 1; a < b; a++, b--) {
+        temp = order[a];
+        order[a] = order[b];
+        order[b] = temp;
+    }
+    return true;
+}
+
+/**
+ * Check room records: IDs, descriptions, start rooms and connectors
+ * Returns false if room IDs don't match their slots, which the graph needs
+ */
+static bool check_rooms(Check *check) {
+    const RoomMap *map = check->map;
+    bool ids_ok = true;
+
+    for (int b = 0; b < map->num_buildings; b++) {
+        if (check->index.start_room[b] == 0) {
+            report(check, ISSUE_START_ROOM, "building %d has no start room; players enter at room 1", b + 1);
+        }
+
+        for (int r = 1; r <= map->rooms_per_building; r++) {
+            size_t slot = room_map_slot(map, b, r);
+            const RoomRecord *room = &map->rooms[slot];
+            if (room->id != (uint32_t)r) {
+                report(check, ISSUE_ROOM_ID, "building %d room %d has ID %u", b + 1, r, room->id);
+                ids_ok = false;
+            }
+
+            char missing[NUM_DIRECTIONS * 3] = "";
+            size_t len = 0;
+            for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+                if (room->desc_len[dir] == 0) {
+                    len += snprintf(missing + len, sizeof(missing) - len, "%s%c",
+                                    len ? ", " : "", direction_to_char(dir));
+                }
+            }
+            if (len) {
+                report(check, ISSUE_DESCRIPTION, "building %d room %d has no description for %s", b + 1, r, missing);
+            }
+
+            bool is_connector = room->flags & ROOM_CONNECTOR;
+            int target = check->index.connector_target[slot];
+            if (is_connector && target < 0) {
+                report(check, ISSUE_CONNECTOR, "building %d room %d is a connector to building %d, which does not exist",
+                       b + 1, r, room->connected_building_id);
+            } else if (!is_connector && room->connected_building_id != 0) {
+                report(check, ISSUE_CONNECTOR, "building %d room %d names building %d but is not a connector",
+                       b + 1, r, room->connected_building_id);
+            }
+
+            bool has_connector_exit = false;
+            for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+                if (map->exits[slot][dir] != CONNECTOR_EXIT) {
+                    continue;
+                }
+                has_connector_exit = true;
+                if (!is_connector) {
+                    report(check, ISSUE_CONNECTOR, "building %d room %d exit %c leads through a connector the room doesn't have",
+                           b + 1, r, direction_to_char(dir));
+                }
+            }
+            if (target >= 0 && !has_connector_exit) {
+                report(check, ISSUE_CONNECTOR, "building %d room %d connects to building %d but no exit leads there",
+                       b + 1, r, target + 1);
+            }
+        }
+    }
+    return ids_ok;
+}
+
+/**
+ * Build the exits within buildings, their reverse, and the connector
+ * rooms grouped by the logical building they lead to
+ * Returns 0 on success, -1 if out of memory
+ */
+static int build_graph(Check *check) {
+    const RoomMap *map = check->map;
+    size_t n = room_map_size(map);
+
+    check->graph = malloc(n * sizeof(*check->graph));
+    check->has_connector = calloc(n, sizeof(bool));
+    check->entries = malloc(map->num_buildings * sizeof(int32_t));
+    check->pred_start = calloc(n + 1, sizeof(int32_t));
+    check->preds = malloc(n * NUM_DIRECTIONS * sizeof(int32_t));
+    check->connector_start = calloc(map->num_buildings + 1, sizeof(int32_t));
+    check->connectors = malloc(n * sizeof(int32_t));
+    if (!check->graph || !check->has_connector || !check->entries || !check->pred_start ||
+        !check->preds || !check->connector_start || !check->connectors) {
+        return -1;
+    }
+
+    for (int b = 0; b < map->num_buildings; b++) {
+        check->entries[b] = room_map_slot(map, b, room_index_entry(&check->index, b));
+    }
+
+    for (size_t slot = 0; slot < n; slot++) {
+        size_t first = slot - slot % map->rooms_per_building;
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            int target = map->exits[slot][dir];
+            check->graph[slot][dir] = target > 0 ? (int32_t)(first + target - 1) : -1;
+            if (target > 0) {
+                check->pred_start[check->graph[slot][dir] + 1]++;
+            } else if (target == CONNECTOR_EXIT && check->index.connector_target[slot] >= 0) {
+                check->has_connector[slot] = true;
+            }
+        }
+        if (check->has_connector[slot]) {
+            check->connector_start[check->index.connector_target[slot] + 1]++;
+        }
+    }
+
+    // Counts to offsets, then fill
+    for (size_t slot = 0; slot < n; slot++) {
+        check->pred_start[slot + 1] += check->pred_start[slot];
+    }
+    for (int b = 0; b < map->num_buildings; b++) {
+        check->connector_start[b + 1] += check->connector_start[b];
+    }
+
+    int32_t *pred_fill = malloc(n * sizeof(int32_t));
+    int32_t *connector_fill = malloc(map->num_buildings * sizeof(int32_t));
+    if (!pred_fill || !connector_fill) {
+        free(pred_fill);
+        free(connector_fill);
+        return -1;
+    }
+    memcpy(pred_fill, check->pred_start, n * sizeof(int32_t));
+    memcpy(connector_fill, check->connector_start, map->num_buildings * sizeof(int32_t));
+    for (size_t slot = 0; slot < n; slot++) {
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            if (check->graph[slot][dir] >= 0) {
+                check->preds[pred_fill[check->graph[slot][dir]]++] = slot;
+            }
+        }
+        if (check->has_connector[slot]) {
+            check->connectors[connector_fill[check->index.connector_target[slot]]++] = slot;
+        }
+    }
+    free(pred_fill);
+    free(connector_fill);
+    return 0;
+}
+
+/**
+ * Mark every room reachable from the entry rooms; a connector can only
+ * lead to an entry room, which is already marked
+ * Returns the number of rooms reached
+ */
+static size_t walk_forward(const Check *check, bool reached[], int32_t queue[]) {
+    size_t head = 0, tail = 0;
+
+    for (int b = 0; b < check->map->num_buildings; b++) {
+        if (!reached[check->entries[b]]) {
+            reached[check->entries[b]] = true;
+            queue[tail++] = check->entries[b];
+        }
+    }
+    while (head < tail) {
+        int32_t slot = queue[head++];
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            int32_t next = check->graph[slot][dir];
+            if (next >= 0 && !reached[next]) {
+                reached[next] = true;
+                queue[tail++] = next;
+            }
+        }
+    }
+    return tail;
+}
+
+/**
+ * Give every room its fewest moves to an item room (-1 if there is no way)
+ * under one building order, walking exits backward from the item rooms
+ */
+static void walk_backward(const Check *check, const uint16_t logical_of[], int32_t distance[], int32_t queue[]) {
+    const RoomMap *map = check->map;
+    size_t n = room_map_size(map);
+    size_t head = 0, tail = 0;
+
+    for (size_t slot = 0; slot < n; slot++) {
+        distance[slot] = map->rooms[slot].flags & ROOM_ITEM ? 0 : -1;
+        if (distance[slot] == 0) {
+            queue[tail++] = slot;
+        }
+    }
+
+    while (head < tail) {
+        int32_t slot = queue[head++];
+        for (int32_t i = check->pred_start[slot]; i < check->pred_start[slot + 1]; i++) {
+            int32_t prev = check->preds[i];
+            if (distance[prev] < 0) {
+                distance[prev] = distance[slot] + 1;
+                queue[tail++] = prev;
+            }
+        }
+
+        // Connectors whose logical target this order puts at this room's building
+        int building = slot / map->rooms_per_building;
+        if (check->entries[building] != slot) {
+            continue;
+        }
+        int logical = logical_of[building];
+        for (int32_t i = check->connector_start[logical]; i < check->connector_start[logical + 1]; i++) {
+            int32_t prev = check->connectors[i];
+            if (distance[prev] < 0) {
+                distance[prev] = distance[slot] + 1;
+                queue[tail++] = prev;
+            }
+        }
+    }
+}
+
+/**
+ * Release everything a check allocated
+ */
+static void check_free(Check *check) {
+    room_index_free(&check->index);
+    free(check->graph);
+    free(check->has_connector);
+    free(check->entries);
+    free(check->pred_start);
+    free(check->preds);
+    free(check->connector_start);
+    free(check->connectors);
+    free(check->reached);
+    free(check->distance);
+    free(check->queue);
+    free(check->trapped_in);
+    free(check->nearest);
+    free(check->farthest);
+    free(check->stranded);
+    free(check->order);
+    free(check->logical_of);
+}
+
+/**
+ * Check a world and log every problem found, with a summary at the end
+ * Returns the number of problems, or -1 if out of memory
+ */
+int world_check(const RoomMap *map) {
+    struct timespec started, finished;
+    clock_gettime(CLOCK_MONOTONIC, &started);
+
+    Check check;
+    memset(&check, 0, sizeof(check));
+    check.map = map;
+    size_t n = room_map_size(map);
+    int num_buildings = map->num_buildings;
+
+    if (build_room_index(&check.index, map) != 0) {
+        return -1;
+    }
+    if (!check_rooms(&check)) {
+        syslog(LOG_WARNING, "World check: room IDs don't match their slots, skipping the exit graph");
+        check_free(&check);
+        return check.problems;
+    }
+
+    bool *reached = check.reached = calloc(n, sizeof(bool));
+    int32_t *distance = check.distance = malloc(n * sizeof(int32_t));
+    int32_t *queue = check.queue = malloc(n * sizeof(int32_t));
+    uint16_t *trapped_in = check.trapped_in = calloc(n, sizeof(uint16_t));
+    int32_t *nearest = check.nearest = malloc(num_buildings * sizeof(int32_t));
+    int32_t *farthest = check.farthest = calloc(num_buildings, sizeof(int32_t));
+    int32_t *stranded = check.stranded = calloc(num_buildings, sizeof(int32_t));
+    uint16_t *order = check.order = malloc(num_buildings * sizeof(uint16_t));
+    uint16_t *logical_of = check.logical_of = malloc(num_buildings * sizeof(uint16_t));
+    if (!reached || !distance || !queue || !trapped_in || !nearest || !farthest ||
+        !stranded || !order || !logical_of || build_graph(&check) != 0) {
+        syslog(LOG_ERR, "Error: Out of memory checking the world");
+        check_free(&check);
+        return -1;
+    }
+
+    bool any_item = false;
+    for (size_t slot = 0; slot < n && !any_item; slot++) {
+        any_item = map->rooms[slot].flags & ROOM_ITEM;
+    }
+    if (!any_item) {
+        report(&check, ISSUE_NO_ITEM, "no room holds the item");
+    }
+
+    size_t num_reached = walk_forward(&check, reached, queue);
+
+    // Every building order if there are few enough, otherwise a fixed sample
+    int all_layouts = 1;
+    for (int b = 2; b <= num_buildings && all_layouts <= CHECK_LAYOUTS; b++) {
+        all_layouts *= b;
+    }
+    bool exhaustive = all_layouts <= CHECK_LAYOUTS;
+    Rng rng;
+    rng_seed(&rng, CHECK_SEED);
+
+    for (int b = 0; b < num_buildings; b++) {
+        order[b] = b;
+        nearest[b] = INT32_MAX;
+    }
+    int layouts = 0;
+    do {
+        for (int b = 0; b < num_buildings; b++) {
+            logical_of[order[b]] = b;
+        }
+        walk_backward(&check, logical_of, distance, queue);
+        layouts++;
+
+        for (size_t slot = 0; slot < n; slot++) {
+            trapped_in[slot] += reached[slot] && distance[slot] < 0;
+        }
+        for (int b = 0; b < num_buildings; b++) {
+            int32_t d = distance[check.entries[b]];
+            if (d < 0) {
+                stranded[b]++;
+            } else {
+                nearest[b] = d < nearest[b] ? d : nearest[b];
+                farthest[b] = d > farthest[b] ? d : farthest[b];
+            }
+        }
+
+        if (!exhaustive) {
+            // Fisher-Yates, as world_shuffle() deals them
+            for (int i = num_buildings - 1; i > 0; i--) {
+                int j = rng_below(&rng, i + 1);
+                uint16_t temp = order[i];
+                order[i] = order[j];
+                order[j] = temp;
+            }
+        }
+    } while (exhaustive ? next_layout(order, num_buildings) : layouts < CHECK_LAYOUTS);
+
+    for (size_t slot = 0; slot < n; slot++) {
+        int b = slot / map->rooms_per_building + 1;
+        int id = slot % map->rooms_per_building + 1;
+        if (!reached[slot]) {
+            report(&check, ISSUE_UNREACHABLE, "building %d room %d can't be reached", b, id);
+            continue;
+        }
+
+        bool dead_end = !check.has_connector[slot];
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            dead_end &= check.graph[slot][dir] < 0;
+        }
+        if (dead_end) {
+            report(&check, ISSUE_DEAD_END, "building %d room %d is a dead end", b, id);
+        } else if (any_item && trapped_in[slot] == layouts) {
+            report(&check, ISSUE_NO_ITEM, "building %d room %d has no way to an item", b, id);
+        } else if (any_item && trapped_in[slot] > 0) {
+            report(&check, ISSUE_NO_ITEM, "building %d room %d has no way to an item in %d of %d building orders",
+                   b, id, trapped_in[slot], layouts);
+        }
+    }
+
+    // Start room distances: each building's while there are few, else the range over all
+    int32_t closest = INT32_MAX, furthest = 0;
+    for (int b = 0; b < num_buildings && any_item; b++) {
+        int id = room_index_entry(&check.index, b);
+        if (stranded[b] == layouts) {
+            report(&check, ISSUE_NO_ITEM, "building %d start room %d has no way to an item", b + 1, id);
+        } else if (stranded[b] > 0) {
+            report(&check, ISSUE_NO_ITEM, "building %d start room %d has no way to an item in %d of %d building orders",
+                   b + 1, id, stranded[b], layouts);
+        } else if (num_buildings > REPORT_LIMIT) {
+            closest = nearest[b] < closest ? nearest[b] : closest;
+            furthest = farthest[b] > furthest ? farthest[b] : furthest;
+        } else if (nearest[b] == farthest[b]) {
+            syslog(LOG_INFO, "World check: building %d start room %d is %d moves from an item",
+                   b + 1, id, nearest[b]);
+        } else {
+            syslog(LOG_INFO, "World check: building %d start room %d is %d to %d moves from an item, depending on the building order",
+                   b + 1, id, nearest[b], farthest[b]);
+        }
+    }
+    if (closest != INT32_MAX) {
+        syslog(LOG_INFO, "World check: start rooms are %d to %d moves from an item", closest, furthest);
+    }
+
+    for (int kind = 0; kind < NUM_ISSUES; kind++) {
+        if (check.counts[kind] > REPORT_LIMIT) {
+            syslog(LOG_WARNING, "World check: %d %s in all, %d not listed",
+                   check.counts[kind], issue_names[kind], check.counts[kind] - REPORT_LIMIT);
+        }
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &finished);
+    long elapsed_us = (finished.tv_sec - started.tv_sec) * 1000000L +
+                      (finished.tv_nsec - started.tv_nsec) / 1000;
+    syslog(LOG_INFO, "World check: %zu of %zu rooms reachable over %d%s building orders, %d problems (%ld us)",
+           num_reached, n, layouts, exhaustive ? "" : " sampled", check.problems, elapsed_us);
+    check_free(&check);
+    return check.problems;
+}
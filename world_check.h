@@ -0,0 +1,19 @@
+/**
+ * world_check.h - Static checks of a world's rooms and exits
+ *
+ * Walks the whole transition graph, connectors included, under every
+ * building order a game can be dealt (a sample of them in large worlds),
+ * and reports rooms players can never reach, rooms they can't leave or
+ * can't get to an item from, missing descriptions and broken connectors,
+ * plus how far each building's start room is from an item. The server
+ * runs it on every load and reload; worldc runs it on every compile, or
+ * alone with -c.
+ */
+#ifndef WORLD_CHECK_H
+#define WORLD_CHECK_H
+#include "rooms.h"
+
+// Function prototypes
+int world_check(const RoomMap *map);
+
+#endif /* WORLD_CHECK_H */
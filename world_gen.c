@@ -0,0 +1,236 @@
+/**
+ * world_gen.c - Seeded generator for large worlds
+ *
+ * Each building is a maze on a square grid of rooms, room 1 in the top
+ * left corner. A binary-tree maze links every other room to its north or
+ * west neighbour, so all rooms lead back to room 1 and every passage works
+ * both ways; a few extra passages east add loops. Every building gets its
+ * own generator derived from the seed, so a building's layout does not
+ * depend on how many buildings come before it.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include "rng.h"
+#include "world_gen.h"
+
+// One room in LOOP_ODDS gets an extra passage east
+#define LOOP_ODDS 8
+
+#define VOCABULARY_SIZE 8
+
+// Stream of the seed buildings derive theirs from, clear of the small
+// stream numbers mud_server derives worker generators from with the same seed
+#define GENERATOR_STREAM UINT64_MAX
+
+static const char *const direction_names[NUM_DIRECTIONS] = { "north", "south", "east", "west" };
+
+static const char *const adjectives[VOCABULARY_SIZE] = {
+    "narrow", "wide", "dim", "bright", "dusty", "quiet", "drafty", "carpeted"
+};
+
+static const char *const passages[VOCABULARY_SIZE] = {
+    "corridor", "hallway", "doorway", "archway", "stairwell", "passage", "ramp", "gallery"
+};
+
+static const char *const places[VOCABULARY_SIZE] = {
+    "lab", "lecture hall", "office", "study room", "storeroom", "lounge", "library", "workshop"
+};
+
+static const char *const walls[VOCABULARY_SIZE] = {
+    "A blank wall.", "A window looks out over the campus.", "Shelves line the wall.",
+    "A locked door.", "A noticeboard covered in flyers.", "A whiteboard.",
+    "A radiator under a window.", "A row of lockers."
+};
+
+/**
+ * Parse a world shape written as BUILDINGSxROOMS, e.g. 100x1000
+ * Returns 0 on success, -1 if it is malformed or out of range
+ */
+int world_gen_parse_shape(const char *text, int *num_buildings, int *rooms_per_building) {
+    char *end;
+    long buildings = strtol(text, &end, 10);
+    if (end == text || (*end != 'x' && *end != 'X')) {
+        return -1;
+    }
+    const char *rooms_text = end + 1;
+    long rooms = strtol(rooms_text, &end, 10);
+    if (end == rooms_text || *end != '\0') {
+        return -1;
+    }
+    if (buildings < 1 || buildings > WORLD_MAX_BUILDINGS || rooms < 1 || rooms > WORLD_MAX_ROOMS ||
+        buildings * rooms > WORLD_MAX_ROOMS) {
+        return -1;
+    }
+    *num_buildings = (int)buildings;
+    *rooms_per_building = (int)rooms;
+    return 0;
+}
+
+/**
+ * Open a passage between two rooms (0-based), dir leading from a to b
+ */
+static void link_rooms(RoomExits exits[], int a, int b, int dir) {
+    // Directions come in opposite pairs: north/south, east/west
+    exits[a][dir] = b + 1;
+    exits[b][dir ^ 1] = a + 1;
+}
+
+/**
+ * Carve a building's maze into exits, rooms laid out width to a row
+ */
+static void carve_maze(RoomExits exits[], int num_rooms, int width, Rng *rng) {
+    for (int i = 0; i < num_rooms; i++) {
+        int x = i % width;
+        bool north = i >= width;
+        bool west = x > 0;
+
+        if (north || west) {
+            int dir = north && west ? (rng_below(rng, 2) ? DIR_NORTH : DIR_WEST) : (north ? DIR_NORTH : DIR_WEST);
+            link_rooms(exits, i, dir == DIR_NORTH ? i - width : i - 1, dir);
+        }
+        if (x + 1 < width && i + 1 < num_rooms && rng_below(rng, LOOP_ODDS) == 0) {
+            link_rooms(exits, i, i + 1, DIR_EAST);
+        }
+    }
+}
+
+/**
+ * Turn a wall of a random room into the building's connector
+ */
+static void place_connector(RoomRecord rooms[], RoomExits exits[], int num_rooms, int target, Rng *rng) {
+    int start = rng_below(rng, num_rooms);
+
+    // Room 1 always has walls to the north and west, so this finds one
+    for (int k = 0; k < num_rooms; k++) {
+        int i = (start + k) % num_rooms;
+        int first_dir = rng_below(rng, NUM_DIRECTIONS);
+        for (int d = 0; d < NUM_DIRECTIONS; d++) {
+            int dir = (first_dir + d) % NUM_DIRECTIONS;
+            if (exits[i][dir] == NO_EXIT) {
+                exits[i][dir] = CONNECTOR_EXIT;
+                rooms[i].flags |= ROOM_CONNECTOR;
+                rooms[i].connected_building_id = target;
+                return;
+            }
+        }
+    }
+}
+
+/**
+ * Write and intern one direction's description
+ * Returns 0 on success, -1 if out of memory
+ */
+static int describe_direction(RoomRecord *room, int dir, int exit, StringArena *strings, Rng *rng) {
+    char desc[MAX_DESCRIPTION_LENGTH];
+    int len;
+
+    if (exit == CONNECTOR_EXIT) {
+        len = snprintf(desc, sizeof(desc), "A door %s leads out to building %d.",
+                       direction_names[dir], room->connected_building_id);
+    } else if (exit == NO_EXIT) {
+        len = snprintf(desc, sizeof(desc), "%s", walls[rng_below(rng, VOCABULARY_SIZE)]);
+    } else {
+        len = snprintf(desc, sizeof(desc), "A %s %s leads %s to the %s.",
+                       adjectives[rng_below(rng, VOCABULARY_SIZE)], passages[rng_below(rng, VOCABULARY_SIZE)],
+                       direction_names[dir], places[rng_below(rng, VOCABULARY_SIZE)]);
+    }
+
+    int64_t offset = string_arena_intern(strings, desc, len);
+    if (offset < 0) {
+        return -1;
+    }
+    room->desc_offset[dir] = (uint32_t)offset;
+    room->desc_len[dir] = (uint16_t)len;
+    return 0;
+}
+
+/**
+ * Generate one building's rooms and exits
+ * Returns 0 on success, -1 if out of memory
+ */
+static int generate_building(GeneratedWorld *world, int building, int num_buildings, int num_rooms, uint64_t seed) {
+    RoomRecord *rooms = &world->rooms[(size_t)building * num_rooms];
+    RoomExits *exits = &world->exits[(size_t)building * num_rooms];
+    Rng rng;
+    rng_seed(&rng, rng_derive(rng_derive(seed, GENERATOR_STREAM), building));
+
+    int width = 1;
+    while ((int64_t)width * width < num_rooms) {
+        width++;
+    }
+    carve_maze(exits, num_rooms, width, &rng);
+
+    for (int i = 0; i < num_rooms; i++) {
+        rooms[i].id = i + 1;
+    }
+    rooms[0].flags |= ROOM_START;
+    rooms[num_rooms > 1 ? 1 + rng_below(&rng, num_rooms - 1) : 0].flags |= ROOM_ITEM;
+
+    // Connectors run in a ring over the logical building numbers
+    if (num_buildings > 1) {
+        place_connector(rooms, exits, num_rooms, (building + 1) % num_buildings + 1, &rng);
+    }
+
+    for (int i = 0; i < num_rooms; i++) {
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            if (describe_direction(&rooms[i], dir, exits[i][dir], &world->strings, &rng) != 0) {
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Generate a world of num_buildings buildings with rooms_per_building rooms each
+ * Returns 0 on success, -1 if the shape is out of range or out of memory
+ */
+int world_gen_build(GeneratedWorld *world, int num_buildings, int rooms_per_building, uint64_t seed) {
+    memset(world, 0, sizeof(*world));
+    if (num_buildings < 1 || num_buildings > WORLD_MAX_BUILDINGS || rooms_per_building < 1 ||
+        (int64_t)num_buildings * rooms_per_building > WORLD_MAX_ROOMS) {
+        syslog(LOG_ERR, "Error: Can't generate a world of %d buildings with %d rooms each",
+               num_buildings, rooms_per_building);
+        return -1;
+    }
+
+    // Zeroed: every exit starts as NO_EXIT and reserved bytes stay zero
+    size_t count = (size_t)num_buildings * rooms_per_building;
+    world->rooms = calloc(count, sizeof(RoomRecord));
+    world->exits = calloc(count, sizeof(RoomExits));
+    if (!world->rooms || !world->exits || string_arena_init(&world->strings) != 0) {
+        syslog(LOG_ERR, "Error: Out of memory generating a %zu room world", count);
+        world_gen_free(world);
+        return -1;
+    }
+
+    for (int b = 0; b < num_buildings; b++) {
+        if (generate_building(world, b, num_buildings, rooms_per_building, seed) != 0) {
+            syslog(LOG_ERR, "Error: Out of memory generating a %zu room world", count);
+            world_gen_free(world);
+            return -1;
+        }
+    }
+    string_arena_seal(&world->strings);
+
+    world->map.num_buildings = num_buildings;
+    world->map.rooms_per_building = rooms_per_building;
+    world->map.rooms = world->rooms;
+    world->map.exits = world->exits;
+    return 0;
+}
+
+/**
+ * Release a generated world
+ */
+void world_gen_free(GeneratedWorld *world) {
+    free(world->rooms);
+    free(world->exits);
+    if (world->strings.data) {
+        string_arena_free(&world->strings);
+    }
+    memset(world, 0, sizeof(*world));
+}
@@ -0,0 +1,29 @@
+/**
+ * world_gen.h - Seeded generator for large worlds
+ *
+ * Builds a world of any size up to the WORLD_MAX_* limits with the same
+ * rules as the hand-written campus: every building has a start room, an
+ * item room and a connector to the next building, and every room can be
+ * reached from the start room. The same seed and shape always give the
+ * same world, byte for byte.
+ */
+#ifndef WORLD_GEN_H
+#define WORLD_GEN_H
+#include <stdint.h>
+#include "rooms.h"
+#include "string_arena.h"
+
+// A generated world; map points into rooms and exits
+typedef struct {
+    RoomRecord *rooms;
+    RoomExits *exits;
+    StringArena strings;
+    RoomMap map;
+} GeneratedWorld;
+
+// Function prototypes
+int world_gen_parse_shape(const char *text, int *num_buildings, int *rooms_per_building);
+int world_gen_build(GeneratedWorld *world, int num_buildings, int rooms_per_building, uint64_t seed);
+void world_gen_free(GeneratedWorld *world);
+
+#endif /* WORLD_GEN_H */
@@ -0,0 +1,264 @@
+/**
+ * world_image.c - Compiled binary world images
+ *
+ * Writing builds the whole image in memory and renames it into place, so a
+ * server never maps a half-written file. Mapping checks every offset and
+ * string before the server is allowed to follow it; a bad image is
+ * rejected at startup instead of crashing a worker later. It reads the
+ * header, the fixed-size room records and exits and the string section's
+ * last byte, never the description text.
+ * The checksum covers every byte, so it is left to world_image_verify()
+ * (worldc -c) rather than paid on every server start.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <syslog.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "world_image.h"
+
+// The image stores these exactly as the server reads them
+_Static_assert(sizeof(RoomRecord) == 36, "RoomRecord layout is part of the world image format");
+_Static_assert(sizeof(WorldImageHeader) % 8 == 0, "WorldImageHeader must keep its 64-bit fields aligned");
+
+/**
+ * Round a section offset up to the image alignment
+ */
+static uint64_t align_offset(uint64_t offset) {
+    return (offset + WORLD_IMAGE_ALIGN - 1) & ~(uint64_t)(WORLD_IMAGE_ALIGN - 1);
+}
+
+/**
+ * FNV-1a hash of the bytes that follow the header
+ */
+static uint64_t image_checksum(const unsigned char *data, size_t len) {
+    uint64_t hash = 0xcbf29ce484222325ULL;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= data[i];
+        hash *= 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+/**
+ * Write a world image to path, replacing any existing file atomically
+ * Returns 0 on success, -1 on error
+ */
+int world_image_write(const char *path, const RoomMap *map, const StringArena *strings) {
+    size_t rooms_size = sizeof(RoomRecord) * room_map_size(map);
+    size_t transitions_size = sizeof(RoomExits) * room_map_size(map);
+
+    WorldImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, WORLD_IMAGE_MAGIC, sizeof(WORLD_IMAGE_MAGIC));
+    header.version = WORLD_IMAGE_VERSION;
+    header.endian = WORLD_IMAGE_ENDIAN;
+    header.header_size = sizeof(WorldImageHeader);
+    header.record_size = sizeof(RoomRecord);
+    header.num_buildings = map->num_buildings;
+    header.rooms_per_building = map->rooms_per_building;
+    header.string_count = strings->count;
+    header.rooms_offset = align_offset(sizeof(WorldImageHeader));
+    header.transitions_offset = align_offset(header.rooms_offset + rooms_size);
+    header.strings_offset = align_offset(header.transitions_offset + transitions_size);
+    header.strings_size = strings->len;
+    header.file_size = header.strings_offset + header.strings_size;
+
+    // Zero-filled, so padding and alignment gaps are the same in every build
+    unsigned char *image = calloc(1, header.file_size);
+    if (!image) {
+        syslog(LOG_ERR, "Error: Out of memory writing world image %s", path);
+        return -1;
+    }
+    memcpy(image + header.rooms_offset, map->rooms, rooms_size);
+    memcpy(image + header.transitions_offset, map->exits, transitions_size);
+    memcpy(image + header.strings_offset, strings->data, strings->len);
+    header.checksum = image_checksum(image + sizeof(header), header.file_size - sizeof(header));
+    memcpy(image, &header, sizeof(header));
+
+    char tmp_path[4096];
+    snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        syslog(LOG_ERR, "Error: Could not create %s", tmp_path);
+        free(image);
+        return -1;
+    }
+
+    size_t written = 0;
+    while (written < header.file_size) {
+        ssize_t n = write(fd, image + written, header.file_size - written);
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    free(image);
+
+    bool ok = written == header.file_size && fsync(fd) == 0;
+    if (close(fd) != 0) {
+        ok = false;
+    }
+    if (!ok) {
+        syslog(LOG_ERR, "Error: Could not write world image %s", tmp_path);
+        unlink(tmp_path);
+        return -1;
+    }
+    if (rename(tmp_path, path) != 0) {
+        syslog(LOG_ERR, "Error: Could not rename %s to %s", tmp_path, path);
+        unlink(tmp_path);
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Check that a section lies inside the image and is aligned
+ */
+static int section_ok(const WorldImageHeader *header, uint64_t offset, uint64_t size) {
+    return offset % WORLD_IMAGE_ALIGN == 0 && offset >= header->header_size &&
+           offset <= header->file_size && size <= header->file_size - offset;
+}
+
+/**
+ * Check every header field, section, record and exit of a mapped image
+ * Returns NULL if the image is usable, otherwise the reason it is not
+ */
+static const char *validate_image(const unsigned char *base, size_t size) {
+    const WorldImageHeader *header = (const WorldImageHeader *)base;
+
+    if (size < sizeof(WorldImageHeader) || memcmp(header->magic, WORLD_IMAGE_MAGIC, sizeof(header->magic)) != 0) {
+        return "not a world image";
+    }
+    if (header->version != WORLD_IMAGE_VERSION) {
+        return "unsupported version";
+    }
+    if (header->endian != WORLD_IMAGE_ENDIAN) {
+        return "written on a machine with the other byte order";
+    }
+    if (header->header_size != sizeof(WorldImageHeader) || header->record_size != sizeof(RoomRecord)) {
+        return "record layout does not match this server";
+    }
+    uint64_t num_rooms = (uint64_t)header->num_buildings * header->rooms_per_building;
+    if (header->num_buildings < 1 || header->num_buildings > WORLD_MAX_BUILDINGS ||
+        header->rooms_per_building < 1 || num_rooms > WORLD_MAX_ROOMS) {
+        return "world dimensions are out of range";
+    }
+    if (header->file_size != size) {
+        return "truncated";
+    }
+
+    size_t rooms_size = sizeof(RoomRecord) * num_rooms;
+    size_t transitions_size = sizeof(RoomExits) * num_rooms;
+    if (!section_ok(header, header->rooms_offset, rooms_size) ||
+        !section_ok(header, header->transitions_offset, transitions_size) ||
+        !section_ok(header, header->strings_offset, header->strings_size)) {
+        return "section out of bounds";
+    }
+    const char *strings = (const char *)base + header->strings_offset;
+    if (header->strings_size == 0 || strings[header->strings_size - 1] != '\0') {
+        return "string section is not terminated";
+    }
+
+    const RoomRecord *rooms = (const void *)(base + header->rooms_offset);
+    const RoomExits *exits = (const void *)(base + header->transitions_offset);
+    for (uint64_t slot = 0; slot < num_rooms; slot++) {
+        const RoomRecord *room = &rooms[slot];
+        if (room->id != slot % header->rooms_per_building + 1 ||
+            (room->flags & ~(ROOM_START | ROOM_ITEM | ROOM_CONNECTOR)) ||
+            room->reserved[0] || room->reserved[1] || room->reserved[2] ||
+            room->connected_building_id < 0 || room->connected_building_id > (int64_t)header->num_buildings) {
+            return "invalid room record";
+        }
+        for (int dir = 0; dir < NUM_DIRECTIONS; dir++) {
+            // Descriptions are bounded like compiled ones, so room messages fit.
+            // The text itself isn't read: the section ends in a NUL, so a
+            // description that starts inside it is a terminated string.
+            uint64_t end = (uint64_t)room->desc_offset[dir] + room->desc_len[dir];
+            if (room->desc_len[dir] >= MAX_DESCRIPTION_LENGTH || end >= header->strings_size) {
+                return "room description out of bounds";
+            }
+            int64_t target = exits[slot][dir];
+            if (target < CONNECTOR_EXIT || target > (int64_t)header->rooms_per_building) {
+                return "invalid exit";
+            }
+        }
+    }
+    return NULL;
+}
+
+/**
+ * Map a world image read-only and validate it
+ * Returns 0 on success, -1 if the file can't be mapped or is invalid
+ */
+int world_image_map(WorldImage *image, const char *path) {
+    memset(image, 0, sizeof(*image));
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        syslog(LOG_ERR, "Error: Could not open world image %s", path);
+        return -1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        syslog(LOG_ERR, "Error: World image %s is empty", path);
+        close(fd);
+        return -1;
+    }
+
+    // MAP_SHARED: every process mapping the image uses the same page-cache pages
+    void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED) {
+        syslog(LOG_ERR, "Error: Could not map world image %s", path);
+        return -1;
+    }
+
+    const char *reason = validate_image(base, st.st_size);
+    if (reason) {
+        syslog(LOG_ERR, "Error: World image %s rejected: %s", path, reason);
+        munmap(base, st.st_size);
+        return -1;
+    }
+
+    const WorldImageHeader *header = base;
+    image->base = base;
+    image->size = st.st_size;
+    image->header = header;
+    image->map.num_buildings = header->num_buildings;
+    image->map.rooms_per_building = header->rooms_per_building;
+    image->map.rooms = (const void *)((const char *)base + header->rooms_offset);
+    image->map.exits = (const void *)((const char *)base + header->transitions_offset);
+    image->strings = (const char *)base + header->strings_offset;
+    image->strings_size = header->strings_size;
+    return 0;
+}
+
+/**
+ * Check a mapped image's checksum, which world_image_map() skips
+ * Returns 0 if it matches, -1 if the image has been changed or damaged
+ */
+int world_image_verify(const WorldImage *image) {
+    const unsigned char *base = image->base;
+    if (image_checksum(base + sizeof(WorldImageHeader), image->size - sizeof(WorldImageHeader)) !=
+        image->header->checksum) {
+        syslog(LOG_ERR, "Error: World image checksum mismatch");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Unmap an image; pointers into it are no longer valid
+ */
+void world_image_unmap(WorldImage *image) {
+    if (image->base) {
+        munmap(image->base, image->size);
+    }
+    memset(image, 0, sizeof(*image));
+}
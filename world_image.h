@@ -0,0 +1,61 @@
+/**
+ * world_image.h - Compiled binary world images
+ *
+ * worldc compiles a text world definition into an image holding the
+ * RoomRecords, the transition table and the description strings exactly
+ * as the server uses them. The server maps the image read-only and points
+ * straight into it, so startup does no parsing and copies no text, and
+ * several servers on one machine share the same page-cache pages.
+ *
+ * Layout: a WorldImageHeader, then each section at a WORLD_IMAGE_ALIGN
+ * boundary. The header gives the world's dimensions, which may be anything
+ * up to WORLD_MAX_BUILDINGS buildings and WORLD_MAX_ROOMS rooms. Numbers
+ * are in the byte order of the machine that ran worldc; the endian field
+ * rejects images from the other byte order.
+ */
+#ifndef WORLD_IMAGE_H
+#define WORLD_IMAGE_H
+#include <stddef.h>
+#include <stdint.h>
+#include "rooms.h"
+
+#define WORLD_IMAGE_MAGIC "MUDWRLD"    // 7 characters plus the NUL fill magic[8]
+#define WORLD_IMAGE_VERSION 2      // 2: dimensions set per image, 32-bit room IDs
+#define WORLD_IMAGE_ENDIAN 0x01020304u
+#define WORLD_IMAGE_ALIGN 64
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t endian;              // WORLD_IMAGE_ENDIAN as stored by the writer
+    uint32_t header_size;         // sizeof(WorldImageHeader)
+    uint32_t record_size;         // sizeof(RoomRecord)
+    uint32_t num_buildings;
+    uint32_t rooms_per_building;
+    uint32_t string_count;        // Unique descriptions
+    uint32_t reserved;
+    uint64_t rooms_offset;        // RoomRecord[num_buildings * rooms_per_building]
+    uint64_t transitions_offset;  // RoomExits[num_buildings * rooms_per_building]
+    uint64_t strings_offset;      // NUL-terminated descriptions; offset 0 is ""
+    uint64_t strings_size;
+    uint64_t file_size;
+    uint64_t checksum;            // FNV-1a of every byte after the header; checked by world_image_verify()
+} WorldImageHeader;
+
+// A mapped image; the pointers stay valid until world_image_unmap()
+typedef struct {
+    void *base;
+    size_t size;
+    const WorldImageHeader *header;
+    RoomMap map;                  // Points into the mapping
+    const char *strings;
+    size_t strings_size;
+} WorldImage;
+
+// Function prototypes
+int world_image_write(const char *path, const RoomMap *map, const StringArena *strings);
+int world_image_map(WorldImage *image, const char *path);
+int world_image_verify(const WorldImage *image);
+void world_image_unmap(WorldImage *image);
+
+#endif /* WORLD_IMAGE_H */
@@ -0,0 +1,522 @@
+/**
+ * worldc - MUD world compiler
+ *
+ * Compiles a text world definition into the binary image mud_server maps
+ * with -W, after checking it the same way the server does on load.
+ * Usage: worldc input.world output.wimg, or worldc -c input.world to only
+ * check a world. worldc -c image.wimg checks a compiled image, including
+ * the checksum of every byte that mud_server skips when it maps one. With
+ * -g BUILDINGSxROOMS [-s seed] it writes a generated world instead, the
+ * same one mud_server -G builds from that seed.
+ *
+ * The text format is line based; blank lines and lines starting with #
+ * are ignored:
+ *
+ *   building <number>
+ *   room <id> [start] [item] [connector <building>]
+ *   <n|s|e|w> <exit> <description>
+ *
+ * A direction line belongs to the room above it. <exit> is the room ID
+ * the direction leads to, "-" for no exit, or ">" to leave through the
+ * room's connector. Descriptions run to the end of the line; write \n for
+ * a line break and \\ for a backslash. Directions that are left out have
+ * no exit and an empty description.
+ *
+ * The world is as large as the file makes it: the highest building number
+ * gives the number of buildings and the highest room ID the rooms in each,
+ * up to WORLD_MAX_BUILDINGS buildings and WORLD_MAX_ROOMS rooms in all.
+ * Every building from 1 up must be defined, each with every room.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <syslog.h>
+#include "rooms.h"
+#include "string_arena.h"
+#include "world_image.h"
+#include "world_check.h"
+#include "world_gen.h"
+
+#define MAX_LINE_LENGTH 1024
+
+// Everything read from the world file, compiled as it is read. The shape
+// comes from a first pass over the file: as many buildings as the highest
+// building number, each with as many rooms as the highest room ID.
+typedef struct {
+    int num_buildings;
+    int rooms_per_building;
+    RoomRecord *records;        // [building * rooms_per_building + room - 1]
+    RoomExits *exits;           // Indexed like records
+    bool *building_seen;        // [building]
+    bool *room_seen;            // Indexed like records
+    uint8_t *directions_seen;   // Indexed like records; one bit per direction
+} WorldSource;
+
+static const char *source_path;
+static int line_number;
+
+/**
+ * Report a syntax error at the current line
+ */
+static void parse_error(const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    fprintf(stderr, "%s:%d: ", source_path, line_number);
+    vfprintf(stderr, format, args);
+    fputc('\n', stderr);
+    va_end(args);
+}
+
+/**
+ * Parse a whole decimal number in [min, max]
+ * Returns 0 on success, -1 if token is not one
+ */
+static int parse_number(const char *token, int min, int max, int *value) {
+    if (!token || !*token) {
+        return -1;
+    }
+    char *end;
+    long n = strtol(token, &end, 10);
+    if (*end != '\0' || n < min || n > max) {
+        return -1;
+    }
+    *value = (int)n;
+    return 0;
+}
+
+/**
+ * Copy a description, turning \n and \\ escapes into their characters
+ * Returns its length, or -1 if it is MAX_DESCRIPTION_LENGTH or longer
+ */
+static int unescape_description(char *dest, const char *src) {
+    size_t len = 0;
+    for (const char *p = src; *p; p++) {
+        char c = *p;
+        if (c == '\\' && (p[1] == 'n' || p[1] == '\\')) {
+            c = p[1] == 'n' ? '\n' : '\\';
+            p++;
+        }
+        if (len + 1 >= MAX_DESCRIPTION_LENGTH) {
+            return -1;
+        }
+        dest[len++] = c;
+    }
+    dest[len] = '\0';
+    return (int)len;
+}
+
+/**
+ * Read one line into line, without its newline
+ * Returns the keyword, with *args pointing after it, or NULL at the end of the file
+ * Blank and comment lines come back as ""
+ */
+static char *read_line(FILE *in, char *line, size_t size, char **args, bool *too_long) {
+    if (!fgets(line, size, in)) {
+        return NULL;
+    }
+    line_number++;
+    size_t len = strlen(line);
+    *too_long = len == size - 1 && line[len - 1] != '\n';
+    line[strcspn(line, "\r\n")] = '\0';
+
+    char *p = line;
+    while (isspace((unsigned char)*p)) {
+        p++;
+    }
+    if (*p == '#') {
+        *p = '\0';
+    }
+
+    // Split off the keyword
+    *args = p + strcspn(p, " \t");
+    if (**args) {
+        *(*args)++ = '\0';
+    }
+    return p;
+}
+
+/**
+ * First pass: find the highest building number and room ID, which set the
+ * world's shape. Malformed lines are left for the second pass to report.
+ * Returns 0 on success, -1 if the world has no rooms or is too large
+ */
+static int measure_world(WorldSource *world, FILE *in) {
+    char line[MAX_LINE_LENGTH];
+    char *args;
+    bool too_long;
+    char *keyword;
+    int number;
+
+    line_number = 0;
+    while ((keyword = read_line(in, line, sizeof(line), &args, &too_long)) != NULL) {
+        if (strcmp(keyword, "building") == 0 &&
+            parse_number(strtok(args, " \t"), 1, WORLD_MAX_BUILDINGS, &number) == 0 &&
+            number > world->num_buildings) {
+            world->num_buildings = number;
+        } else if (strcmp(keyword, "room") == 0 &&
+                   parse_number(strtok(args, " \t"), 1, WORLD_MAX_ROOMS, &number) == 0 &&
+                   number > world->rooms_per_building) {
+            world->rooms_per_building = number;
+        }
+    }
+
+    if (world->num_buildings == 0 || world->rooms_per_building == 0) {
+        fprintf(stderr, "%s: no buildings or rooms\n", source_path);
+        return -1;
+    }
+    if ((uint64_t)world->num_buildings * world->rooms_per_building > WORLD_MAX_ROOMS) {
+        fprintf(stderr, "%s: %d buildings of %d rooms is over the %d room limit\n",
+                source_path, world->num_buildings, world->rooms_per_building, WORLD_MAX_ROOMS);
+        return -1;
+    }
+
+    size_t rooms = (size_t)world->num_buildings * world->rooms_per_building;
+    // Zeroed, so struct padding is the same in every image and rooms start with no exits
+    world->records = calloc(rooms, sizeof(RoomRecord));
+    world->exits = calloc(rooms, sizeof(RoomExits));
+    world->building_seen = calloc(world->num_buildings, sizeof(bool));
+    world->room_seen = calloc(rooms, sizeof(bool));
+    world->directions_seen = calloc(rooms, sizeof(uint8_t));
+    if (!world->records || !world->exits || !world->building_seen || !world->room_seen || !world->directions_seen) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Release what measure_world() allocated
+ */
+static void free_world_source(WorldSource *world) {
+    free(world->records);
+    free(world->exits);
+    free(world->building_seen);
+    free(world->room_seen);
+    free(world->directions_seen);
+}
+
+/**
+ * Parse "room <id> [start] [item] [connector <building>]"
+ */
+static int parse_room(WorldSource *world, int building, char *args, size_t *slot) {
+    int id;
+    char *token = strtok(args, " \t");
+    if (parse_number(token, 1, world->rooms_per_building, &id) != 0) {
+        parse_error("room ID must be between 1 and %d", world->rooms_per_building);
+        return -1;
+    }
+    size_t room_slot = (size_t)building * world->rooms_per_building + id - 1;
+    if (world->room_seen[room_slot]) {
+        parse_error("room %d defined twice", id);
+        return -1;
+    }
+
+    RoomRecord *record = &world->records[room_slot];
+    record->id = (uint32_t)id;
+    while ((token = strtok(NULL, " \t")) != NULL) {
+        if (strcmp(token, "start") == 0) {
+            record->flags |= ROOM_START;
+        } else if (strcmp(token, "item") == 0) {
+            record->flags |= ROOM_ITEM;
+        } else if (strcmp(token, "connector") == 0) {
+            int target;
+            token = strtok(NULL, " \t");
+            if (parse_number(token, 0, world->num_buildings, &target) != 0) {
+                parse_error("connector needs a building number between 0 and %d", world->num_buildings);
+                return -1;
+            }
+            record->connected_building_id = target;
+            record->flags |= ROOM_CONNECTOR;
+        } else {
+            parse_error("unknown room flag %s", token);
+            return -1;
+        }
+    }
+
+    world->room_seen[room_slot] = true;
+    *slot = room_slot;
+    return 0;
+}
+
+/**
+ * Parse "<n|s|e|w> <exit> <description>" for the current room
+ */
+static int parse_direction(WorldSource *world, StringArena *strings, size_t slot, int dir, char *args) {
+    if (slot == SIZE_MAX) {
+        parse_error("direction outside a room");
+        return -1;
+    }
+    if (world->directions_seen[slot] & (1 << dir)) {
+        parse_error("direction given twice for this room");
+        return -1;
+    }
+
+    // The exit is the first word; the description is everything after one separator
+    char *exit_token = args;
+    char *description = args + strcspn(args, " \t");
+    if (*description) {
+        *description++ = '\0';
+    }
+
+    int target;
+    if (strcmp(exit_token, "-") == 0) {
+        target = NO_EXIT;
+    } else if (strcmp(exit_token, ">") == 0) {
+        target = CONNECTOR_EXIT;
+    } else if (parse_number(exit_token, 1, world->rooms_per_building, &target) != 0) {
+        parse_error("exit must be a room ID between 1 and %d, - or >", world->rooms_per_building);
+        return -1;
+    }
+
+    char text[MAX_DESCRIPTION_LENGTH];
+    int len = unescape_description(text, description);
+    if (len < 0) {
+        parse_error("description is longer than %d characters", MAX_DESCRIPTION_LENGTH - 1);
+        return -1;
+    }
+    int64_t offset = string_arena_intern(strings, text, len);
+    if (offset < 0) {
+        fprintf(stderr, "Out of memory\n");
+        return -1;
+    }
+
+    world->records[slot].desc_offset[dir] = (uint32_t)offset;
+    world->records[slot].desc_len[dir] = (uint16_t)len;
+    world->exits[slot][dir] = target;
+    world->directions_seen[slot] |= 1 << dir;
+    return 0;
+}
+
+/**
+ * Second pass: read the world into records, exits and strings
+ * Returns 0 on success, -1 after reporting the first error
+ */
+static int parse_world(WorldSource *world, StringArena *strings, FILE *in) {
+    char line[MAX_LINE_LENGTH];
+    char *args;
+    bool too_long;
+    char *keyword;
+    int building = -1;
+    size_t slot = SIZE_MAX;
+
+    line_number = 0;
+    while ((keyword = read_line(in, line, sizeof(line), &args, &too_long)) != NULL) {
+        if (too_long) {
+            parse_error("line is too long");
+            return -1;
+        }
+        if (*keyword == '\0') {
+            continue;
+        }
+
+        if (strcmp(keyword, "building") == 0) {
+            int number;
+            if (parse_number(strtok(args, " \t"), 1, world->num_buildings, &number) != 0) {
+                parse_error("building number must be between 1 and %d", world->num_buildings);
+                return -1;
+            }
+            if (world->building_seen[number - 1]) {
+                parse_error("building %d defined twice", number);
+                return -1;
+            }
+            world->building_seen[number - 1] = true;
+            building = number - 1;
+            slot = SIZE_MAX;
+        } else if (strcmp(keyword, "room") == 0) {
+            if (building < 0) {
+                parse_error("room outside a building");
+                return -1;
+            }
+            if (parse_room(world, building, args, &slot) != 0) {
+                return -1;
+            }
+        } else if (keyword[1] == '\0' && direction_from_char(keyword[0]) >= 0) {
+            if (parse_direction(world, strings, slot, direction_from_char(keyword[0]), args) != 0) {
+                return -1;
+            }
+        } else {
+            parse_error("unknown keyword %s", keyword);
+            return -1;
+        }
+    }
+
+    // Every building has the same number of rooms, so each must define them all
+    for (int b = 0; b < world->num_buildings; b++) {
+        if (!world->building_seen[b]) {
+            fprintf(stderr, "%s: building %d is missing (buildings must be numbered 1 to %d)\n",
+                    source_path, b + 1, world->num_buildings);
+            return -1;
+        }
+        for (int r = 0; r < world->rooms_per_building; r++) {
+            if (!world->room_seen[(size_t)b * world->rooms_per_building + r]) {
+                fprintf(stderr, "%s: building %d room %d is missing (every building needs rooms 1 to %d)\n",
+                        source_path, b + 1, r + 1, world->rooms_per_building);
+                return -1;
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * Compile a text world file into records, exits and strings
+ * Returns 0 on success, -1 after reporting the first error
+ */
+static int compile_world(WorldSource *world, StringArena *strings) {
+    FILE *in = fopen(source_path, "r");
+    if (!in) {
+        fprintf(stderr, "%s: cannot open\n", source_path);
+        return -1;
+    }
+    int status = measure_world(world, in);
+    if (status == 0) {
+        rewind(in);
+        status = parse_world(world, strings, in);
+    }
+    fclose(in);
+    return status;
+}
+
+/**
+ * True if the file starts with the world image magic
+ */
+static bool is_world_image(const char *path) {
+    char magic[sizeof(WORLD_IMAGE_MAGIC)] = { 0 };
+    FILE *in = fopen(path, "rb");
+    if (!in) {
+        return false;
+    }
+    size_t n = fread(magic, 1, sizeof(magic), in);
+    fclose(in);
+    return n == sizeof(magic) && memcmp(magic, WORLD_IMAGE_MAGIC, sizeof(magic)) == 0;
+}
+
+/**
+ * Check a compiled image the way the server loads it, plus its checksum
+ * Returns 0 on success, -1 after reporting the first error
+ */
+static int check_image(const char *path) {
+    WorldImage image;
+    if (world_image_map(&image, path) != 0) {
+        return -1;
+    }
+    int status = world_image_verify(&image);
+    if (status == 0 && world_check(&image.map) < 0) {
+        status = -1;
+    }
+    if (status == 0) {
+        printf("%s: %d buildings, %zu rooms, checksum ok\n",
+               path, image.map.num_buildings, room_map_size(&image.map));
+    }
+    world_image_unmap(&image);
+    return status;
+}
+
+/**
+ * Print usage and fail
+ */
+static int usage(const char *program) {
+    fprintf(stderr, "Usage: %s input.world output.wimg\n"
+            "       %s -c input.world|image.wimg\n"
+            "       %s -g BUILDINGSxROOMS [-s seed] [-c] [output.wimg]\n", program, program, program);
+    return EXIT_FAILURE;
+}
+
+/**
+ * Main function
+ */
+int main(int argc, char *argv[]) {
+    bool check_only = false;
+    int num_buildings = 0;
+    int rooms_per_building = 0;
+    uint64_t seed = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "cg:s:")) != -1) {
+        switch (opt) {
+            case 'c':
+                check_only = true;
+                break;
+            case 'g':
+                if (world_gen_parse_shape(optarg, &num_buildings, &rooms_per_building) != 0) {
+                    fprintf(stderr, "Bad world shape %s (use BUILDINGSxROOMS, at most %d buildings and %d rooms)\n",
+                            optarg, WORLD_MAX_BUILDINGS, WORLD_MAX_ROOMS);
+                    return EXIT_FAILURE;
+                }
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 0);
+                break;
+            default:
+                return usage(argv[0]);
+        }
+    }
+
+    // A generated world has no input file; a compiled one needs it
+    int inputs = num_buildings ? 0 : 1;
+    int outputs = check_only ? 0 : 1;
+    if (argc - optind != inputs + outputs) {
+        return usage(argv[0]);
+    }
+    source_path = inputs ? argv[optind] : NULL;
+    const char *output_path = outputs ? argv[optind + inputs] : NULL;
+
+    // Shared modules report errors through syslog; echo them to stderr
+    openlog("worldc", LOG_PERROR, LOG_USER);
+
+    if (check_only && source_path && is_world_image(source_path)) {
+        int status = check_image(source_path);
+        closelog();
+        return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+
+    WorldSource world;
+    GeneratedWorld generated;
+    StringArena strings;
+    RoomMap map;
+    const StringArena *map_strings;
+    int status;
+
+    memset(&world, 0, sizeof(world));
+    memset(&generated, 0, sizeof(generated));
+    memset(&strings, 0, sizeof(strings));
+    if (num_buildings) {
+        status = world_gen_build(&generated, num_buildings, rooms_per_building, seed);
+        map = generated.map;
+        map_strings = &generated.strings;
+    } else {
+        if (string_arena_init(&strings) != 0) {
+            fprintf(stderr, "Out of memory\n");
+            return EXIT_FAILURE;
+        }
+        status = compile_world(&world, &strings);
+        string_arena_seal(&strings);
+        map.num_buildings = world.num_buildings;
+        map.rooms_per_building = world.rooms_per_building;
+        map.rooms = world.records;
+        map.exits = world.exits;
+        map_strings = &strings;
+    }
+
+    // Problems are reported, not fatal: the world still plays, just not well
+    if (status == 0 && world_check(&map) < 0) {
+        status = -1;
+    }
+    if (status == 0 && output_path) {
+        status = world_image_write(output_path, &map, map_strings);
+    }
+    if (status == 0 && output_path) {
+        printf("%s: %d buildings, %zu rooms, %zu unique descriptions in %zu bytes\n",
+               output_path, map.num_buildings, room_map_size(&map), map_strings->count, map_strings->len);
+    }
+
+    world_gen_free(&generated);
+    string_arena_free(&strings);
+    free_world_source(&world);
+    closelog();
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}